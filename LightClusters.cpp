@@ -0,0 +1,181 @@
+#include "LightClusters.hpp"
+
+#include "WorkerPool.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <thread>
+
+//use SSE to test spheres against four tile boundaries at a time where available:
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LIGHTCLUSTERS_SSE 1
+#include <emmintrin.h>
+#else
+#define LIGHTCLUSTERS_SSE 0
+#endif
+
+//tile boundaries as (normalized) world-space planes, structure-of-arrays and padded to a multiple of four:
+// positive side of boundary i is "right of / above" it
+template< uint32_t N >
+struct BoundaryPlanes {
+	enum : uint32_t { Count = N + 1, Padded = (N + 1 + 3) / 4 * 4 };
+	float nx[Padded] = {}, ny[Padded] = {}, nz[Padded] = {}, d[Padded] = {};
+
+	//boundary i is where (clip.'axis' / clip.w) == -1 + 2 i / N:
+	BoundaryPlanes(glm::vec4 const &axis_row, glm::vec4 const &w_row) {
+		for (uint32_t i = 0; i < Count; ++i) {
+			float ndc = -1.0f + 2.0f * float(i) / float(N);
+			glm::vec4 plane = axis_row - ndc * w_row;
+			float len = glm::length(glm::vec3(plane));
+			if (len > 0.0f) plane /= len;
+			nx[i] = plane.x; ny[i] = plane.y; nz[i] = plane.z; d[i] = plane.w;
+		}
+	}
+
+	//bit i of result is set if tile i (between boundaries i and i + 1) might overlap the sphere:
+	uint32_t overlapped(LightClusters::Sphere const &sphere) const {
+		uint32_t above = 0; //bit i: sphere reaches positive side of boundary i
+		uint32_t below = 0; //bit i: sphere reaches negative side of boundary i
+		#if LIGHTCLUSTERS_SSE
+		__m128 cx = _mm_set1_ps(sphere.center.x), cy = _mm_set1_ps(sphere.center.y), cz = _mm_set1_ps(sphere.center.z);
+		__m128 r = _mm_set1_ps(sphere.radius);
+		__m128 neg_r = _mm_set1_ps(-sphere.radius);
+		for (uint32_t i = 0; i < Padded; i += 4) {
+			__m128 dist = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(cx, _mm_loadu_ps(nx + i)), _mm_mul_ps(cy, _mm_loadu_ps(ny + i))),
+				_mm_add_ps(_mm_mul_ps(cz, _mm_loadu_ps(nz + i)), _mm_loadu_ps(d + i))
+			);
+			above |= uint32_t(_mm_movemask_ps(_mm_cmpge_ps(dist, neg_r))) << i;
+			below |= uint32_t(_mm_movemask_ps(_mm_cmple_ps(dist, r))) << i;
+		}
+		#else
+		for (uint32_t i = 0; i < Padded; ++i) {
+			float dist = (sphere.center.x * nx[i] + sphere.center.y * ny[i]) + (sphere.center.z * nz[i] + d[i]);
+			if (dist >= -sphere.radius) above |= (1U << i);
+			if (dist <= sphere.radius) below |= (1U << i);
+		}
+		#endif
+		return above & (below >> 1) & ((1U << N) - 1);
+	}
+};
+
+//first and last set bit of a nonzero mask:
+static void bit_range(uint32_t mask, uint8_t *first, uint8_t *last) {
+	uint8_t f = 0;
+	while (!(mask & (1U << f))) ++f;
+	uint8_t l = 31;
+	while (!(mask & (1U << l))) --l;
+	*first = f;
+	*last = l;
+}
+
+void LightClusters::build(glm::mat4 const &world_to_clip, std::vector< Sphere > const &spheres, uint32_t threads) {
+	static_assert(X <= 31 && Y <= 31 && Z <= 255, "cluster counts must fit in masks / ranges");
+
+	glm::mat4 rows = glm::transpose(world_to_clip);
+	BoundaryPlanes< X > x_planes(rows[0], rows[3]);
+	BoundaryPlanes< Y > y_planes(rows[1], rows[3]);
+
+	//w changes by (at most) this much per unit distance:
+	float w_per_unit = glm::length(glm::vec3(rows[3]));
+
+	//depth range covered by visible spheres:
+	float min_w = std::numeric_limits< float >::infinity();
+	float max_w = 0.0f;
+	for (Sphere const &sphere : spheres) {
+		float w = glm::dot(rows[3], glm::vec4(sphere.center, 1.0f));
+		float reach = sphere.radius * w_per_unit;
+		if (w + reach <= 0.0f) continue; //behind the camera
+		min_w = std::min(min_w, w - reach);
+		max_w = std::max(max_w, w + reach);
+	}
+	//(slices shouldn't get arbitrarily thin when a light surrounds the camera)
+	near = std::max(min_w, 0.05f);
+	float far = std::max(max_w, near * 2.0f);
+	depth_scale = float(Z) / std::log(far / near);
+
+	//cluster ranges touched by each sphere:
+	ranges.resize(spheres.size());
+	for (size_t s = 0; s < spheres.size(); ++s) {
+		Sphere const &sphere = spheres[s];
+		Range &range = ranges[s];
+		range.z0 = 1; range.z1 = 0; //(empty)
+
+		float w = glm::dot(rows[3], glm::vec4(sphere.center, 1.0f));
+		float reach = sphere.radius * w_per_unit;
+		if (w + reach <= 0.0f) continue;
+
+		uint32_t x_mask = x_planes.overlapped(sphere);
+		uint32_t y_mask = y_planes.overlapped(sphere);
+		if (x_mask == 0 || y_mask == 0) continue;
+		bit_range(x_mask, &range.x0, &range.x1);
+		bit_range(y_mask, &range.y0, &range.y1);
+
+		auto slice = [&](float at) {
+			float z = std::floor(std::log(std::max(at, near) / near) * depth_scale);
+			return uint8_t(std::min(std::max(z, 0.0f), float(Z - 1)));
+		};
+		range.z0 = slice(w - reach);
+		range.z1 = slice(w + reach);
+	}
+
+	//bin spheres slice-by-slice (slices are independent, so they can be done in parallel):
+	slice_indices.resize(Z);
+	slice_counts.resize(Z);
+	auto bin_slice = [&](uint32_t z) {
+		std::vector< uint32_t > &counts = slice_counts[z];
+		std::vector< uint32_t > &list = slice_indices[z];
+		counts.assign(X * Y, 0);
+		for (Range const &range : ranges) {
+			if (z < range.z0 || z > range.z1) continue;
+			for (uint32_t y = range.y0; y <= range.y1; ++y) {
+				for (uint32_t x = range.x0; x <= range.x1; ++x) {
+					counts[y * X + x] += 1;
+				}
+			}
+		}
+		//(turn counts into offsets, fill, then turn them back)
+		uint32_t total = 0;
+		for (uint32_t &count : counts) {
+			uint32_t c = count;
+			count = total;
+			total += c;
+		}
+		list.resize(total);
+		for (uint32_t s = 0; s < uint32_t(ranges.size()); ++s) {
+			Range const &range = ranges[s];
+			if (z < range.z0 || z > range.z1) continue;
+			for (uint32_t y = range.y0; y <= range.y1; ++y) {
+				for (uint32_t x = range.x0; x <= range.x1; ++x) {
+					list[counts[y * X + x]++] = s;
+				}
+			}
+		}
+		//(counts[c] is now the end of cluster c's list)
+	};
+
+	if (threads == 0) threads = std::max(1U, std::thread::hardware_concurrency());
+	uint32_t workers = uint32_t(std::min< size_t >({ size_t(threads), spheres.size() / MinLightsPerThread, size_t(Z) }));
+	if (workers <= 1) {
+		for (uint32_t z = 0; z < Z; ++z) bin_slice(z);
+	} else {
+		WorkerPool::shared().run(workers, [&bin_slice, workers](uint32_t w) {
+			for (uint32_t z = w; z < Z; z += workers) bin_slice(z);
+		});
+	}
+
+	//concatenate slices:
+	clusters.resize(X * Y * Z);
+	indices.clear();
+	for (uint32_t z = 0; z < Z; ++z) {
+		uint32_t base = uint32_t(indices.size());
+		uint32_t begin = 0;
+		for (uint32_t c = 0; c < X * Y; ++c) {
+			uint32_t end = slice_counts[z][c];
+			clusters[z * X * Y + c] = glm::uvec2(base + begin, end - begin);
+			begin = end;
+		}
+		indices.insert(indices.end(), slice_indices[z].begin(), slice_indices[z].end());
+	}
+}
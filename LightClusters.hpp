@@ -0,0 +1,53 @@
+#pragma once
+
+/*
+ * LightClusters bins lights (as bounding spheres) into a grid of "clusters"
+ *  that divide the view frustum: X by Y tiles in screen space, each split into
+ *  Z slices by depth (exponentially spaced, so near slices are thin).
+ *
+ * A fragment shader finds its cluster from its clip-space position and only
+ *  considers the lights listed there, so shading cost depends on how many
+ *  lights overlap each cluster rather than on the total number of lights.
+ *
+ * Usage (see Scene::draw):
+ *  clusters.build(world_to_clip, spheres);
+ *  //upload clusters.clusters and clusters.indices; pass near and depth_scale to shaders:
+ *  // slice = clamp(int(log(w / near) * depth_scale), 0, Z-1)
+ *
+ */
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstdint>
+
+struct LightClusters {
+	enum : uint32_t { X = 16, Y = 9, Z = 24 };
+	enum : uint32_t { MinLightsPerThread = 64 }; //below this, building doesn't bother with threads
+
+	struct Sphere {
+		glm::vec3 center;
+		float radius;
+	};
+
+	//bin 'spheres' (in world space) into the clusters of the view frustum of 'world_to_clip':
+	// - clip-space w should be depth along the view direction (as it is for perspective projections)
+	// - spheres entirely behind the camera or outside the frustum are left out
+	// - work is split by depth slice across up to 'threads' threads of WorkerPool::shared() (0 means one per hardware thread)
+	void build(glm::mat4 const &world_to_clip, std::vector< Sphere > const &spheres, uint32_t threads = 1);
+
+	//results:
+	float near = 1.0f; //clip-space w at the start of the first slice
+	float depth_scale = 1.0f; //slices per unit of log(w / near)
+	std::vector< glm::uvec2 > clusters; //(first, count) in indices for each cluster; cluster (x,y,z) is at (z * Y + y) * X + x
+	std::vector< uint32_t > indices; //sphere indices, grouped by cluster
+
+	//------ internals ------
+	//ranges of clusters touched by each sphere (z1 < z0 if sphere isn't visible):
+	struct Range {
+		uint8_t x0, x1, y0, y1, z0, z1;
+	};
+	std::vector< Range > ranges;
+	std::vector< std::vector< uint32_t > > slice_indices; //per slice, built in parallel then concatenated
+	std::vector< std::vector< uint32_t > > slice_counts;
+};
@@ -1,6 +1,7 @@
 #include "LitColorTextureProgram.hpp"
 
 #include "gl_compile_program.hpp"
+#include "Mesh.hpp"
 #include "gl_errors.hpp"
 
 Scene::Drawable::Pipeline lit_color_texture_program_pipeline;
@@ -11,17 +12,7 @@ Load< LitColorTextureProgram > lit_color_texture_program(LoadTagEarly, []() -> L
 	//----- build the pipeline template -----
 	lit_color_texture_program_pipeline.program = ret->program;
 
-	lit_color_texture_program_pipeline.OBJECT_TO_CLIP_mat4 = ret->OBJECT_TO_CLIP_mat4;
-	lit_color_texture_program_pipeline.OBJECT_TO_LIGHT_mat4x3 = ret->OBJECT_TO_LIGHT_mat4x3;
-	lit_color_texture_program_pipeline.NORMAL_TO_LIGHT_mat3 = ret->NORMAL_TO_LIGHT_mat3;
-
-	/* This will be used later if/when we build a light loop into the Scene:
-	lit_color_texture_program_pipeline.LIGHT_TYPE_int = ret->LIGHT_TYPE_int;
-	lit_color_texture_program_pipeline.LIGHT_LOCATION_vec3 = ret->LIGHT_LOCATION_vec3;
-	lit_color_texture_program_pipeline.LIGHT_DIRECTION_vec3 = ret->LIGHT_DIRECTION_vec3;
-	lit_color_texture_program_pipeline.LIGHT_ENERGY_vec3 = ret->LIGHT_ENERGY_vec3;
-	lit_color_texture_program_pipeline.LIGHT_CUTOFF_float = ret->LIGHT_CUTOFF_float;
-	*/
+	//(transforms, lights, and material all come from uniform blocks and buffer textures, so no uniform locations are needed)
 
 	//make a 1-pixel white texture to bind by default:
 	GLuint tex;
@@ -43,26 +34,48 @@ Load< LitColorTextureProgram > lit_color_texture_program(LoadTagEarly, []() -> L
 	return ret;
 });
 
-LitColorTextureProgram::LitColorTextureProgram() {
+Load< LitColorTextureProgram > lit_color_texture_program_instanced(LoadTagEarly, []() -> LitColorTextureProgram const * {
+	LitColorTextureProgram *ret = new LitColorTextureProgram(true);
+
+	//drawables copied from the pipeline template can be instanced once they have an instanced_vao:
+	lit_color_texture_program_pipeline.instanced_program = ret->program;
+
+	return ret;
+});
+
+LitColorTextureProgram::LitColorTextureProgram(bool instanced) {
+	//transforms come from the "Draw" uniform block, or (when instanced) per-instance attributes:
+	std::string transforms = instanced
+		? "in mat4 OBJECT_TO_CLIP;\n"
+		  "in mat4x3 OBJECT_TO_LIGHT;\n"
+		  "in mat3 NORMAL_TO_LIGHT;\n"
+		: "layout(std140) uniform Draw {\n"
+		  "	mat4 OBJECT_TO_CLIP;\n"
+		  "	mat4x3 OBJECT_TO_LIGHT;\n"
+		  "	mat3 NORMAL_TO_LIGHT;\n"
+		  "};\n";
+
 	//Compile vertex and fragment shaders using the convenient 'gl_compile_program' helper function:
 	program = gl_compile_program(
 		//vertex shader:
 		"#version 330\n"
-		"uniform mat4 OBJECT_TO_CLIP;\n"
-		"uniform mat4x3 OBJECT_TO_LIGHT;\n"
-		"uniform mat3 NORMAL_TO_LIGHT;\n"
+		+ transforms +
 		"in vec4 Position;\n"
 		"in vec3 Normal;\n"
+		"in vec2 NormalOct;\n"
 		"in vec4 Color;\n"
 		"in vec2 TexCoord;\n"
 		"out vec3 position;\n"
 		"out vec3 normal;\n"
 		"out vec4 color;\n"
 		"out vec2 texCoord;\n"
+		"out vec4 clipPosition;\n"
+		+ std::string(MeshBuffer::DecodeNormalGLSL) +
 		"void main() {\n"
 		"	gl_Position = OBJECT_TO_CLIP * Position;\n"
+		"	clipPosition = gl_Position;\n"
 		"	position = OBJECT_TO_LIGHT * Position;\n"
-		"	normal = NORMAL_TO_LIGHT * Normal;\n"
+		"	normal = NORMAL_TO_LIGHT * decode_normal(Normal, NormalOct);\n"
 		"	color = Color;\n"
 		"	texCoord = TexCoord;\n"
 		"}\n"
@@ -70,39 +83,68 @@ LitColorTextureProgram::LitColorTextureProgram() {
 		//fragment shader:
 		"#version 330\n"
 		"uniform sampler2D TEX;\n"
-		"uniform int LIGHT_TYPE;\n"
-		"uniform vec3 LIGHT_LOCATION;\n"
-		"uniform vec3 LIGHT_DIRECTION;\n"
-		"uniform vec3 LIGHT_ENERGY;\n"
-		"uniform float LIGHT_CUTOFF;\n"
+		"uniform samplerBuffer LIGHTS;\n"
+		"uniform usamplerBuffer CLUSTERS;\n"
+		"uniform usamplerBuffer LIGHT_INDICES;\n"
+		"layout(std140) uniform Frame {\n"
+		"	mat4 WORLD_TO_CLIP;\n"
+		"	uvec4 CLUSTER_COUNTS;\n"
+		"	vec4 CLUSTER_DEPTH;\n"
+		"};\n"
+		"layout(std140) uniform Material {\n"
+		"	vec4 TINT;\n"
+		"};\n"
 		"in vec3 position;\n"
 		"in vec3 normal;\n"
 		"in vec4 color;\n"
 		"in vec2 texCoord;\n"
+		"in vec4 clipPosition;\n"
 		"out vec4 fragColor;\n"
+		//light contribution (see Scene::LightTextureUnit for the layout of LIGHTS):
+		"vec3 shade(int light, vec3 n) {\n"
+		"	vec4 location_type = texelFetch(LIGHTS, 3 * light + 0);\n"
+		"	vec4 direction_cutoff = texelFetch(LIGHTS, 3 * light + 1);\n"
+		"	vec4 energy_range = texelFetch(LIGHTS, 3 * light + 2);\n"
+		"	int type = int(location_type.w);\n"
+		"	vec3 direction = direction_cutoff.xyz;\n"
+		"	if (type == 1) { //hemi light \n"
+		"		return (dot(n,-direction) * 0.5 + 0.5) * energy_range.rgb;\n"
+		"	} else if (type == 3) { //directional light \n"
+		"		return max(0.0, dot(n,-direction)) * energy_range.rgb;\n"
+		"	}\n"
+		"	vec3 l = (location_type.xyz - position);\n"
+		"	float dis2 = dot(l,l);\n"
+		"	l = normalize(l);\n"
+		"	float nl = max(0.0, dot(n, l)) / max(1.0, dis2);\n"
+		"	if (type == 2) { //spot light \n"
+		"		float c = dot(l,-direction);\n"
+		"		nl *= smoothstep(direction_cutoff.w,mix(direction_cutoff.w,1.0,0.1), c);\n"
+		"	}\n"
+		"	//(fade to zero at range, so cutting off lights at their cluster bounds doesn't show)\n"
+		"	float f = dis2 / (energy_range.w * energy_range.w);\n"
+		"	nl *= clamp(1.0 - f * f, 0.0, 1.0);\n"
+		"	return nl * energy_range.rgb;\n"
+		"}\n"
 		"void main() {\n"
 		"	vec3 n = normalize(normal);\n"
-		"	vec3 e;\n"
-		"	if (LIGHT_TYPE == 0) { //point light \n"
-		"		vec3 l = (LIGHT_LOCATION - position);\n"
-		"		float dis2 = dot(l,l);\n"
-		"		l = normalize(l);\n"
-		"		float nl = max(0.0, dot(n, l)) / max(1.0, dis2);\n"
-		"		e = nl * LIGHT_ENERGY;\n"
-		"	} else if (LIGHT_TYPE == 1) { //hemi light \n"
-		"		e = (dot(n,-LIGHT_DIRECTION) * 0.5 + 0.5) * LIGHT_ENERGY;\n"
-		"	} else if (LIGHT_TYPE == 2) { //spot light \n"
-		"		vec3 l = (LIGHT_LOCATION - position);\n"
-		"		float dis2 = dot(l,l);\n"
-		"		l = normalize(l);\n"
-		"		float nl = max(0.0, dot(n, l)) / max(1.0, dis2);\n"
-		"		float c = dot(l,-LIGHT_DIRECTION);\n"
-		"		nl *= smoothstep(LIGHT_CUTOFF,mix(LIGHT_CUTOFF,1.0,0.1), c);\n"
-		"		e = nl * LIGHT_ENERGY;\n"
-		"	} else { //(LIGHT_TYPE == 3) //directional light \n"
-		"		e = max(0.0, dot(n,-LIGHT_DIRECTION)) * LIGHT_ENERGY;\n"
+		"	vec3 e = vec3(0.0);\n"
+		"	int globals = int(CLUSTER_COUNTS.w);\n"
+		"	for (int i = 0; i < globals; ++i) {\n"
+		"		e += shade(i, n);\n"
 		"	}\n"
-		"	vec4 albedo = texture(TEX, texCoord) * color;\n"
+		//point and spot lights come from this fragment's cluster:
+		"	ivec3 counts = ivec3(CLUSTER_COUNTS.xyz);\n"
+		"	vec2 ndc = clipPosition.xy / clipPosition.w;\n"
+		"	ivec3 cluster = ivec3(\n"
+		"		ivec2((ndc * 0.5 + 0.5) * vec2(counts.xy)),\n"
+		"		int(floor(log(clipPosition.w / CLUSTER_DEPTH.x) * CLUSTER_DEPTH.y))\n"
+		"	);\n"
+		"	cluster = clamp(cluster, ivec3(0), counts - 1);\n"
+		"	uvec2 list = texelFetch(CLUSTERS, (cluster.z * counts.y + cluster.y) * counts.x + cluster.x).xy;\n"
+		"	for (uint i = 0u; i < list.y; ++i) {\n"
+		"		e += shade(globals + int(texelFetch(LIGHT_INDICES, int(list.x + i)).x), n);\n"
+		"	}\n"
+		"	vec4 albedo = texture(TEX, texCoord) * color * TINT;\n"
 		"	fragColor = vec4(e*albedo.rgb, albedo.a);\n"
 		"}\n"
 	);
@@ -115,17 +157,9 @@ LitColorTextureProgram::LitColorTextureProgram() {
 	Color_vec4 = glGetAttribLocation(program, "Color");
 	TexCoord_vec2 = glGetAttribLocation(program, "TexCoord");
 
-	//look up the locations of uniforms:
-	OBJECT_TO_CLIP_mat4 = glGetUniformLocation(program, "OBJECT_TO_CLIP");
-	OBJECT_TO_LIGHT_mat4x3 = glGetUniformLocation(program, "OBJECT_TO_LIGHT");
-	NORMAL_TO_LIGHT_mat3 = glGetUniformLocation(program, "NORMAL_TO_LIGHT");
-
-	LIGHT_TYPE_int = glGetUniformLocation(program, "LIGHT_TYPE");
-	LIGHT_LOCATION_vec3 = glGetUniformLocation(program, "LIGHT_LOCATION");
-	LIGHT_DIRECTION_vec3 = glGetUniformLocation(program, "LIGHT_DIRECTION");
-	LIGHT_ENERGY_vec3 = glGetUniformLocation(program, "LIGHT_ENERGY");
-	LIGHT_CUTOFF_float = glGetUniformLocation(program, "LIGHT_CUTOFF");
-
+	//connect the Frame, Material, and Draw blocks and the light samplers to the bindings Scene::draw() uses:
+	Scene::bind_uniform_blocks(program);
+	Scene::bind_light_samplers(program);
 
 	GLuint TEX_sampler2D = glGetUniformLocation(program, "TEX");
 
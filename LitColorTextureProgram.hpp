@@ -6,7 +6,8 @@
 
 //Shader program that draws transformed, lit, textured vertices tinted with vertex colors:
 struct LitColorTextureProgram {
-	LitColorTextureProgram();
+	//if 'instanced', OBJECT_TO_CLIP, OBJECT_TO_LIGHT, and NORMAL_TO_LIGHT are per-instance attributes rather than uniforms:
+	LitColorTextureProgram(bool instanced = false);
 	~LitColorTextureProgram();
 
 	GLuint program = 0;
@@ -17,24 +18,20 @@ struct LitColorTextureProgram {
 	GLuint Color_vec4 = -1U;
 	GLuint TexCoord_vec2 = -1U;
 
-	//Uniform (per-invocation variable) locations:
-	GLuint OBJECT_TO_CLIP_mat4 = -1U;
-	GLuint OBJECT_TO_LIGHT_mat4x3 = -1U;
-	GLuint NORMAL_TO_LIGHT_mat3 = -1U;
-
-	//lighting:
-	GLuint LIGHT_TYPE_int = -1U;
-	GLuint LIGHT_LOCATION_vec3 = -1U;
-	GLuint LIGHT_DIRECTION_vec3 = -1U;
-	GLuint LIGHT_ENERGY_vec3 = -1U;
-	GLuint LIGHT_CUTOFF_float = -1U;
-	
+	//Uniforms come from blocks (see Scene::UniformBlockBinding):
+	//Frame -- light cluster parameters (set by Scene::draw())
+	//Material -- TINT (set via Scene::Drawable::Pipeline::material)
+	//Draw -- OBJECT_TO_CLIP, OBJECT_TO_LIGHT, NORMAL_TO_LIGHT (per-instance attributes if instanced)
+
 	//Textures:
 	//TEXTURE0 - texture that is accessed by TexCoord
+	//TEXTURE4,5,6 - LIGHTS, CLUSTERS, LIGHT_INDICES (see Scene::LightTextureUnit; bound by Scene::draw())
 };
 
 extern Load< LitColorTextureProgram > lit_color_texture_program;
+extern Load< LitColorTextureProgram > lit_color_texture_program_instanced;
 
 //For convenient scene-graph setup, copy this object:
 // NOTE: by default, has texture bound to 1-pixel white texture -- so it's okay to use with vertex-color-only meshes.
+// NOTE: instanced_program is set to lit_color_texture_program_instanced; set instanced_vao to allow instancing.
 extern Scene::Drawable::Pipeline lit_color_texture_program_pipeline;
@@ -0,0 +1,31 @@
+#pragma once
+
+/*
+ * A "MappedFile" is a read-only view of a file's contents, memory-mapped
+ *  where the platform supports it (so loading doesn't copy the file
+ *  into a buffer before it is parsed).
+ *
+ * MappedFile file(data_path("level.w"));
+ * char const *at = file.data;
+ * char const *end = file.data + file.size;
+ *
+ */
+
+#include <string>
+#include <cstddef>
+
+struct MappedFile {
+	//map a file:
+	// note: will throw if the file can't be opened.
+	MappedFile(std::string const &filename);
+	~MappedFile();
+
+	MappedFile(MappedFile const &) = delete;
+	MappedFile &operator=(MappedFile const &) = delete;
+
+	char const *data = nullptr; //file contents (nullptr if file is empty)
+	size_t size = 0; //size of file in bytes
+
+	//internals:
+	void *handle = nullptr; //platform mapping handle (if any)
+};
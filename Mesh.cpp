@@ -2,6 +2,7 @@
 #include "read_write_chunk.hpp"
 
 #include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
 
 #include <stdexcept>
 #include <fstream>
@@ -9,9 +10,36 @@
 #include <vector>
 #include <string>
 #include <set>
+#include <algorithm>
 #include <cstddef>
+#include <cstring>
+#include <cmath>
 
-MeshBuffer::MeshBuffer(std::string const &filename) {
+char const * const MeshBuffer::DecodeNormalGLSL =
+	"vec3 decode_normal(vec3 Normal, vec2 NormalOct) {\n"
+	"	if (Normal != vec3(0.0)) return Normal;\n"
+	"	vec3 n = vec3(NormalOct, 1.0 - abs(NormalOct.x) - abs(NormalOct.y));\n"
+	"	float t = max(-n.z, 0.0);\n"
+	"	n.x += (n.x >= 0.0 ? -t : t);\n"
+	"	n.y += (n.y >= 0.0 ? -t : t);\n"
+	"	return normalize(n);\n"
+	"}\n"
+;
+
+//octahedral encoding of a (nonzero) normal -- the inverse of decode_normal():
+static glm::vec2 encode_octahedral(glm::vec3 n) {
+	n /= (std::abs(n.x) + std::abs(n.y) + std::abs(n.z));
+	glm::vec2 e = glm::vec2(n.x, n.y);
+	if (n.z < 0.0f) {
+		e = glm::vec2(
+			(1.0f - std::abs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f),
+			(1.0f - std::abs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f)
+		);
+	}
+	return e;
+}
+
+MeshBuffer::MeshBuffer(std::string const &filename, Layout layout_) : layout(layout_) {
 	glGenBuffers(1, &buffer);
 
 	std::ifstream file(filename, std::ios::binary);
@@ -31,18 +59,21 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 	if (filename.size() >= 5 && filename.substr(filename.size()-5) == ".pnct") {
 		read_chunk(file, "pnct", &data);
 
-		//upload data:
-		glBindBuffer(GL_ARRAY_BUFFER, buffer);
-		glBufferData(GL_ARRAY_BUFFER, data.size() * sizeof(Vertex), data.data(), GL_STATIC_DRAW);
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		if (layout == Layout::Full) {
+			//upload data:
+			glBindBuffer(GL_ARRAY_BUFFER, buffer);
+			glBufferData(GL_ARRAY_BUFFER, data.size() * sizeof(Vertex), data.data(), GL_STATIC_DRAW);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-		total = GLuint(data.size()); //store total for later checks on index
+			//store attrib locations:
+			Position = Attrib(3, GL_FLOAT, GL_FALSE, sizeof(Vertex), offsetof(Vertex, Position));
+			Normal = Attrib(3, GL_FLOAT, GL_FALSE, sizeof(Vertex), offsetof(Vertex, Normal));
+			Color = Attrib(4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex), offsetof(Vertex, Color));
+			TexCoord = Attrib(2, GL_FLOAT, GL_FALSE, sizeof(Vertex), offsetof(Vertex, TexCoord));
+		}
+		//(compact data is converted and uploaded once mesh bounds are known, below)
 
-		//store attrib locations:
-		Position = Attrib(3, GL_FLOAT, GL_FALSE, sizeof(Vertex), offsetof(Vertex, Position));
-		Normal = Attrib(3, GL_FLOAT, GL_FALSE, sizeof(Vertex), offsetof(Vertex, Normal));
-		Color = Attrib(4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex), offsetof(Vertex, Color));
-		TexCoord = Attrib(2, GL_FLOAT, GL_FALSE, sizeof(Vertex), offsetof(Vertex, TexCoord));
+		total = GLuint(data.size()); //store total for later checks on index
 	} else {
 		throw std::runtime_error("Unknown file type '" + filename + "'");
 	}
@@ -60,7 +91,93 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 		std::vector< IndexEntry > index;
 		read_chunk(file, "idx0", &index);
 
-		for (auto const &entry : index) {
+		//(optional) element chunks for indexed meshes:
+		// elr0 has the range of ele0 used by each index entry; ele0 has vertex numbers relative to the entry's vertex_begin
+		struct ElementRange {
+			uint32_t element_begin, element_end;
+		};
+		static_assert(sizeof(ElementRange) == 8, "Element range should be packed");
+
+		std::vector< ElementRange > element_ranges;
+		std::vector< uint32_t > elements;
+		if (file.peek() != EOF) {
+			read_chunk(file, "elr0", &element_ranges);
+			read_chunk(file, "ele0", &elements);
+			if (element_ranges.size() != index.size()) {
+				throw std::runtime_error("element range count doesn't match index entry count");
+			}
+		}
+
+		//(optional, after the element chunks) levels of detail -- simplified versions of indexed meshes:
+		// each entry is another element range drawing (some of) an index entry's vertices; entries for the same
+		// index entry are levels 1, 2, ... in order
+		struct LODEntry {
+			uint32_t index_entry;
+			uint32_t element_begin, element_end;
+		};
+		static_assert(sizeof(LODEntry) == 12, "LOD entry should be packed");
+
+		std::vector< LODEntry > lod_entries;
+		bool has_lods = false;
+		if (!element_ranges.empty() && file.peek() != EOF) {
+			read_chunk(file, "lod0", &lod_entries);
+			has_lods = true;
+		}
+
+		//(optional, after the lod chunk -- written by asset-compiler) bounds of each index entry's vertices,
+		// so they don't need to be found here:
+		struct BoundsEntry {
+			glm::vec3 min, max;
+		};
+		static_assert(sizeof(BoundsEntry) == 24, "Bounds entry should be packed");
+
+		std::vector< BoundsEntry > bounds;
+		if (has_lods && file.peek() != EOF) {
+			read_chunk(file, "bnd0", &bounds);
+			if (bounds.size() != index.size()) {
+				throw std::runtime_error("bounds count doesn't match index entry count");
+			}
+		}
+
+		//indices are stored in 16 bits where possible (aligned to their size):
+		std::vector< uint8_t > index_data;
+
+		//copy elements [begin,end) to index_data as the indices of 'mesh':
+		auto add_indices = [&](uint32_t element_begin, uint32_t element_end, Mesh *mesh) {
+			if (!(element_begin <= element_end && element_end <= elements.size())) {
+				throw std::runtime_error("element range has out-of-range begin/end");
+			}
+			mesh->index_count = element_end - element_begin;
+			mesh->index_type = (mesh->count <= 0x10000 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT);
+			uint32_t index_size = (mesh->index_type == GL_UNSIGNED_SHORT ? 2 : 4);
+			index_data.resize((index_data.size() + index_size - 1) / index_size * index_size);
+			mesh->index_start = GLuint(index_data.size());
+			index_data.resize(index_data.size() + mesh->index_count * index_size);
+			for (uint32_t e = element_begin; e < element_end; ++e) {
+				if (elements[e] >= mesh->count) {
+					throw std::runtime_error("element refers to vertex outside of its mesh");
+				}
+				uint8_t *at = index_data.data() + mesh->index_start + (e - element_begin) * index_size;
+				if (mesh->index_type == GL_UNSIGNED_SHORT) {
+					uint16_t element = uint16_t(elements[e]);
+					std::memcpy(at, &element, sizeof(element));
+				} else {
+					std::memcpy(at, &elements[e], sizeof(elements[e]));
+				}
+			}
+		};
+
+		//meshes (and names) by index entry, for attaching levels of detail:
+		std::vector< std::pair< std::string, Mesh > > entry_meshes;
+		entry_meshes.reserve(index.size());
+		std::vector< bool > entry_inserted; //(levels of detail of meshes that collided with another's name are skipped)
+		entry_inserted.reserve(index.size());
+
+		//(compact layout) vertex ranges, to quantize against their mesh's bounds:
+		std::vector< std::pair< IndexEntry, Mesh > > compact_ranges;
+
+		for (uint32_t i = 0; i < index.size(); ++i) {
+			IndexEntry const &entry = index[i];
 			if (!(entry.name_begin <= entry.name_end && entry.name_end <= strings.size())) {
 				throw std::runtime_error("index entry has out-of-range name begin/end");
 			}
@@ -72,14 +189,100 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 			mesh.type = GL_TRIANGLES;
 			mesh.start = entry.vertex_begin;
 			mesh.count = entry.vertex_end - entry.vertex_begin;
-			for (uint32_t v = entry.vertex_begin; v < entry.vertex_end; ++v) {
-				mesh.min = glm::min(mesh.min, data[v].Position);
-				mesh.max = glm::max(mesh.max, data[v].Position);
+			if (!bounds.empty()) {
+				mesh.min = bounds[i].min;
+				mesh.max = bounds[i].max;
+			} else {
+				for (uint32_t v = entry.vertex_begin; v < entry.vertex_end; ++v) {
+					mesh.min = glm::min(mesh.min, data[v].Position);
+					mesh.max = glm::max(mesh.max, data[v].Position);
+				}
+			}
+			if (layout == Layout::Compact && mesh.count != 0) {
+				mesh.position_offset = mesh.min;
+				mesh.position_scale = mesh.max - mesh.min;
+				compact_ranges.emplace_back(entry, mesh);
+			}
+			if (!element_ranges.empty()) {
+				add_indices(element_ranges[i].element_begin, element_ranges[i].element_end, &mesh);
 			}
 			bool inserted = meshes.insert(std::make_pair(name, mesh)).second;
 			if (!inserted) {
 				std::cerr << "WARNING: mesh name '" + name + "' in filename '" + filename + "' collides with existing mesh." << std::endl;
 			}
+			entry_meshes.emplace_back(name, mesh);
+			entry_inserted.emplace_back(inserted);
+		}
+
+		for (LODEntry const &entry : lod_entries) {
+			if (entry.index_entry >= entry_meshes.size()) {
+				throw std::runtime_error("LOD entry refers to out-of-range index entry");
+			}
+			if (!entry_inserted[entry.index_entry]) continue;
+			std::string const &name = entry_meshes[entry.index_entry].first;
+			//(a level of detail is its mesh with different indices)
+			Mesh mesh = entry_meshes[entry.index_entry].second;
+			add_indices(entry.element_begin, entry.element_end, &mesh);
+			lods[name].emplace_back(mesh);
+		}
+
+		//upload indices:
+		if (!index_data.empty()) {
+			glGenBuffers(1, &index_buffer);
+			//(uploaded through GL_ARRAY_BUFFER, since the element array binding belongs to whichever vertex array object is bound)
+			glBindBuffer(GL_ARRAY_BUFFER, index_buffer);
+			glBufferData(GL_ARRAY_BUFFER, index_data.size(), index_data.data(), GL_STATIC_DRAW);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+		}
+
+		if (layout == Layout::Compact) {
+			struct CompactVertex {
+				glm::u16vec3 Position; //fraction of mesh bounds
+				uint16_t _pad = 0; //(keeps the following attributes 4-byte aligned)
+				glm::i16vec2 NormalOct;
+				glm::u8vec4 Color;
+				glm::u16vec2 TexCoord; //half floats
+			};
+			static_assert(sizeof(CompactVertex) == 3*2+2+2*2+4*1+2*2, "CompactVertex is packed.");
+			std::vector< CompactVertex > compact(data.size());
+
+			std::vector< bool > converted(data.size(), false);
+			for (auto const &range : compact_ranges) {
+				IndexEntry const &entry = range.first;
+				Mesh const &mesh = range.second;
+				//(flat dimensions have zero scale, and always quantize to zero)
+				glm::vec3 inv_scale = glm::vec3(
+					mesh.position_scale.x > 0.0f ? 1.0f / mesh.position_scale.x : 0.0f,
+					mesh.position_scale.y > 0.0f ? 1.0f / mesh.position_scale.y : 0.0f,
+					mesh.position_scale.z > 0.0f ? 1.0f / mesh.position_scale.z : 0.0f
+				);
+				for (uint32_t v = entry.vertex_begin; v < entry.vertex_end; ++v) {
+					if (converted[v]) {
+						throw std::runtime_error("compact layout needs meshes with disjoint vertex ranges");
+					}
+					converted[v] = true;
+					Vertex const &in = data[v];
+					CompactVertex &out = compact[v];
+					glm::vec3 fraction = glm::clamp((in.Position - mesh.position_offset) * inv_scale, glm::vec3(0.0f), glm::vec3(1.0f));
+					out.Position = glm::u16vec3(glm::round(fraction * 65535.0f));
+					glm::vec2 normal = (in.Normal == glm::vec3(0.0f) ? glm::vec2(0.0f) : encode_octahedral(in.Normal));
+					out.NormalOct = glm::i16vec2(glm::round(glm::clamp(normal, glm::vec2(-1.0f), glm::vec2(1.0f)) * 32767.0f));
+					out.Color = in.Color;
+					uint32_t tex_coord = glm::packHalf2x16(in.TexCoord);
+					out.TexCoord = glm::u16vec2(uint16_t(tex_coord & 0xffff), uint16_t(tex_coord >> 16));
+				}
+			}
+
+			//upload data:
+			glBindBuffer(GL_ARRAY_BUFFER, buffer);
+			glBufferData(GL_ARRAY_BUFFER, compact.size() * sizeof(CompactVertex), compact.data(), GL_STATIC_DRAW);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+			//store attrib locations:
+			Position = Attrib(3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(CompactVertex), offsetof(CompactVertex, Position));
+			NormalOct = Attrib(2, GL_SHORT, GL_TRUE, sizeof(CompactVertex), offsetof(CompactVertex, NormalOct));
+			Color = Attrib(4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(CompactVertex), offsetof(CompactVertex, Color));
+			TexCoord = Attrib(2, GL_HALF_FLOAT, GL_FALSE, sizeof(CompactVertex), offsetof(CompactVertex, TexCoord));
 		}
 	}
 
@@ -106,7 +309,23 @@ const Mesh &MeshBuffer::lookup(std::string const &name) const {
 	return f->second;
 }
 
-GLuint MeshBuffer::make_vao_for_program(GLuint program) const {
+const Mesh &MeshBuffer::lookup(std::string const &name, uint32_t lod) const {
+	if (lod == 0) return lookup(name);
+	auto f = lods.find(name);
+	if (f == lods.end()) return lookup(name);
+	return f->second[std::min< size_t >(lod, f->second.size()) - 1];
+}
+
+uint32_t MeshBuffer::lod_count(std::string const &name) const {
+	auto f = lods.find(name);
+	if (f == lods.end()) {
+		lookup(name); //(throws if the mesh doesn't exist)
+		return 1;
+	}
+	return 1 + uint32_t(f->second.size());
+}
+
+GLuint MeshBuffer::make_vao_for_program(GLuint program, std::vector< GLuint > const &bound_elsewhere) const {
 	//create a new vertex array object:
 	GLuint vao = 0;
 	glGenVertexArrays(1, &vao);
@@ -125,11 +344,17 @@ GLuint MeshBuffer::make_vao_for_program(GLuint program) const {
 	};
 	bind_attribute("Position", Position);
 	bind_attribute("Normal", Normal);
+	bind_attribute("NormalOct", NormalOct);
 	bind_attribute("Color", Color);
 	bind_attribute("TexCoord", TexCoord);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	//indices for indexed meshes (element array binding is part of the vertex array object's state):
+	if (index_buffer != 0) glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
 	glBindVertexArray(0);
 
+	//(the caller takes care of these:)
+	bound.insert(bound_elsewhere.begin(), bound_elsewhere.end());
+
 	//Check that all active attributes were bound:
 	GLint active = 0;
 	glGetProgramiv(program, GL_ACTIVE_ATTRIBUTES, &active);
@@ -141,6 +366,10 @@ GLuint MeshBuffer::make_vao_for_program(GLuint program) const {
 		glGetActiveAttrib(program, i, 100, NULL, &size, &type, name);
 		name[99] = '\0';
 		GLint location = glGetAttribLocation(program, name);
+		//(programs that read normals from either layout -- see DecodeNormalGLSL -- only get one of Normal and NormalOct bound)
+		if (std::string(name) == "Normal" || std::string(name) == "NormalOct") {
+			if (bound.count(GLuint(glGetAttribLocation(program, "Normal"))) || bound.count(GLuint(glGetAttribLocation(program, "NormalOct")))) continue;
+		}
 		if (!bound.count(GLuint(location))) {
 			throw std::runtime_error("ERROR: active attribute '" + std::string(name) + "' in program is not bound.");
 		}
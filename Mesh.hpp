@@ -7,6 +7,17 @@
  *  a single OpenGL array buffer. Individual meshes can be looked up by name
  *  using the MeshBuffer::lookup() function.
  *
+ * Meshes may also be indexed -- drawn as a list of vertex numbers from the
+ *  MeshBuffer's index_buffer -- so shared vertices are stored only once.
+ *
+ * Indexed meshes may come with simplified versions ("levels of detail") for
+ *  drawing at a distance; look them up with MeshBuffer::lookup(name, lod).
+ *
+ * Vertices can be stored in a compact (quantized) layout to save memory
+ *  bandwidth; shaders that read normals should decode them with
+ *  MeshBuffer::DecodeNormalGLSL, and drawing code should pass the mesh's
+ *  position_offset/position_scale along (see Scene::Drawable::Pipeline).
+ *
  */
 
 #include "GL.hpp"
@@ -14,6 +25,7 @@
 #include <map>
 #include <limits>
 #include <string>
+#include <vector>
 
 
 struct Mesh {
@@ -23,6 +35,16 @@ struct Mesh {
 	GLuint start = 0; //index of first vertex
 	GLuint count = 0; //count of vertices
 
+	//If indexed, the mesh's primitives use 'index_count' indices (vertex numbers relative to 'start'):
+	GLenum index_type = GL_NONE; //GL_UNSIGNED_SHORT or GL_UNSIGNED_INT if indexed, GL_NONE if not
+	GLuint index_start = 0; //byte offset of first index in index_buffer
+	GLuint index_count = 0; //count of indices
+
+	//Vertex positions in the buffer are decoded as position_offset + position_scale * Position:
+	// (for the compact layout, Position is a 16-bit fraction of the bounding box; otherwise this leaves it alone)
+	glm::vec3 position_offset = glm::vec3(0.0f);
+	glm::vec3 position_scale = glm::vec3(1.0f);
+
 	//Bounding box.
 	//useful for debug visualization and (perhaps, eventually) collision detection:
 	glm::vec3 min = glm::vec3( std::numeric_limits< float >::infinity());
@@ -30,25 +52,53 @@ struct Mesh {
 };
 
 struct MeshBuffer {
-	//construct from a file:
+	//vertex layouts a buffer can use:
+	enum class Layout {
+		Full, //32 bytes: float3 Position, float3 Normal, u8x4 Color, float2 TexCoord
+		Compact, //20 bytes: unorm16x3 Position (+ 2 bytes padding), snorm16x2 NormalOct (octahedral-encoded normal), u8x4 Color, half2 TexCoord
+	};
+
+	//construct from a file, converting vertices to 'layout':
 	// note: will throw if file fails to read.
-	MeshBuffer(std::string const &filename);
+	// note: the compact layout needs meshes with disjoint vertex ranges (as written by export-meshes.py)
+	MeshBuffer(std::string const &filename, Layout layout = Layout::Full);
 
 	//look up a particular mesh by name:
 	// note: will throw if mesh not found.
 	const Mesh &lookup(std::string const &name) const;
+
+	//look up a level of detail of a mesh -- level 0 is the mesh itself, later levels have fewer triangles:
+	// (levels share the mesh's vertex range and index type; levels past the last stored one give the last one)
+	// note: will throw if mesh not found.
+	const Mesh &lookup(std::string const &name, uint32_t lod) const;
+	//number of levels of detail of a mesh (1 if it has no simplified versions):
+	// note: will throw if mesh not found.
+	uint32_t lod_count(std::string const &name) const;
 	
 	//build a vertex array object that links this vbo to attributes to a program:
-	// note: will throw if program defines attributes not contained in this buffer
-	GLuint make_vao_for_program(GLuint program) const;
+	// 'bound_elsewhere' lists attribute locations the caller binds on the vertex array object itself afterward
+	//  (e.g., per-instance attributes that don't come from this buffer)
+	// note: will throw if program defines other attributes not contained in this buffer
+	GLuint make_vao_for_program(GLuint program, std::vector< GLuint > const &bound_elsewhere = {}) const;
+
+	//GLSL function 'vec3 decode_normal(vec3 Normal, vec2 NormalOct)' for vertex shaders that read normals from either layout:
+	// (declare 'in vec3 Normal; in vec2 NormalOct;' -- make_vao_for_program binds whichever one the buffer has,
+	//  and the other reads as zero)
+	static char const * const DecodeNormalGLSL;
+
+	//Layout of vertices in the buffer:
+	Layout layout = Layout::Full;
 
 	//This is the OpenGL vertex buffer object containing the mesh data:
 	GLuint buffer = 0;
+	//..and the buffer holding indices for indexed meshes (0 if there are none; vertex array objects from make_vao_for_program use it as their element array):
+	GLuint index_buffer = 0;
 
 	//-- internals ---
 
 	//used by the lookup() function:
 	std::map< std::string, Mesh > meshes;
+	std::map< std::string, std::vector< Mesh > > lods; //levels of detail 1, 2, ... of meshes that have them
 
 	//These 'Attrib' structures describe the location of various attributes within the buffer (in exactly format wanted by glVertexAttribPointer). They are set when the file is loaded and are used by the "make_vao_for_program" call:
 	struct Attrib {
@@ -65,6 +115,7 @@ struct MeshBuffer {
 
 	Attrib Position;
 	Attrib Normal;
+	Attrib NormalOct;
 	Attrib Color;
 	Attrib TexCoord;
 };
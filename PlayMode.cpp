@@ -11,30 +11,44 @@
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtx/quaternion.hpp>
 
+#include <algorithm>
 #include <random>
 
 GLuint phonebank_meshes_for_lit_color_texture_program = 0;
+GLuint phonebank_meshes_for_lit_color_texture_program_instanced = 0;
 Load< MeshBuffer > phonebank_meshes(LoadTagDefault, []() -> MeshBuffer const * {
-	MeshBuffer const *ret = new MeshBuffer(data_path("phone-bank.pnct"));
+	MeshBuffer const *ret = new MeshBuffer(data_path("phone-bank.pnct"), MeshBuffer::Layout::Compact);
 	phonebank_meshes_for_lit_color_texture_program = ret->make_vao_for_program(lit_color_texture_program->program);
+	phonebank_meshes_for_lit_color_texture_program_instanced = Scene::make_instanced_vao(*ret, lit_color_texture_program_instanced->program);
 	return ret;
 });
 
 Load< Scene > phonebank_scene(LoadTagDefault, []() -> Scene const * {
-	return new Scene(data_path("phone-bank.scene"), [&](Scene &scene, Scene::Transform *transform, std::string const &mesh_name){
-		Mesh const &mesh = phonebank_meshes->lookup(mesh_name);
-
+	Scene *ret = new Scene(data_path("phone-bank.scene"), [&](Scene &scene, Scene::Transform *transform, std::string const &mesh_name){
 		scene.drawables.emplace_back(transform);
 		Scene::Drawable &drawable = scene.drawables.back();
 
 		drawable.pipeline = lit_color_texture_program_pipeline;
 
 		drawable.pipeline.vao = phonebank_meshes_for_lit_color_texture_program;
-		drawable.pipeline.type = mesh.type;
-		drawable.pipeline.start = mesh.start;
-		drawable.pipeline.count = mesh.count;
+		drawable.pipeline.instanced_vao = phonebank_meshes_for_lit_color_texture_program_instanced;
+		drawable.set_mesh(*phonebank_meshes, mesh_name);
 
 	});
+
+	//the scene doesn't come with any lamps, so light it from above:
+	if (ret->lights.empty()) {
+		ret->transforms.emplace_back();
+		Scene::Transform &transform = ret->transforms.back();
+		ret->set_name(transform, "Sky");
+		ret->lights.emplace_back(&transform);
+		ret->invalidate_index();
+		Scene::Light &light = ret->lights.back();
+		light.type = Scene::Light::Hemisphere; //(pointing along -z, as lights do)
+		light.energy = glm::vec3(1000.0f, 1000.0f, 1000.0f);
+	}
+
+	return ret;
 });
 
 WalkMesh const *walkmesh = nullptr;
@@ -44,11 +58,13 @@ Load< WalkMeshes > phonebank_walkmeshes(LoadTagDefault, []() -> WalkMeshes const
 	return ret;
 });
 
-PlayMode::PlayMode() : scene(*phonebank_scene) {
-	for (auto& transform : scene.transforms) {
-		if (transform.name == "Player") player1.transform = &transform;
-		if (transform.name == "Player2") player2.transform = &transform;
-	}
+PlayMode::PlayMode() {
+	scene.instance(*phonebank_scene);
+	scene.snapshot(&start_state);
+
+	player1.transform = scene.find_transform("Player");
+	player2.transform = scene.find_transform("Player2");
+	if (!player1.transform || !player2.transform) throw std::runtime_error("Expecting scene to have transforms named 'Player' and 'Player2'.");
 
 	//start player walking at nearest walk point:
 	player1.at = walkmesh->nearest_walk_point(player1.transform->position);
@@ -145,6 +161,7 @@ void PlayMode::update(float elapsed) {
 		if (game_over) return;
 
 		if (restart) {
+			scene.restore(start_state);
 			player1.at = start1;
 			player2.at = start2;
 			move1 = glm::vec2(0.0f, 0.0f);
@@ -170,99 +187,18 @@ void PlayMode::update(float elapsed) {
 		}
 
 		//get move in world coordinate system:
-		glm::vec3 remain1 = player1.transform->make_local_to_world() * glm::vec4(move1.x, move1.y, 0.0f, 0.0f);
-		glm::vec3 remain2 = player2.transform->make_local_to_world() * glm::vec4(move2.x, move2.y, 0.0f, 0.0f);
-
-		//using a for() instead of a while() here so that if walkpoint gets stuck in
-		//some awkward case, code will not infinite loop:
-		for (uint32_t iter = 0; iter < 10; ++iter) {
-			if (remain1 == glm::vec3(0.0f)) break;
-			WalkPoint end;
-			float time;
-			walkmesh->walk_in_triangle(player1.at, remain1, &end, &time);
-			player1.at = end;
-			if (time == 1.0f) {
-				//finished within triangle:
-				remain1 = glm::vec3(0.0f);
-				break;
-			}
-			//some step remains:
-			remain1 *= (1.0f - time);
-			//try to step over edge:
-			glm::quat rotation;
-			if (walkmesh->cross_edge(player1.at, &end, &rotation)) {
-				//stepped to a new triangle:
-				player1.at = end;
-				//rotate step to follow surface:
-				remain1 = rotation * remain1;
-			} else {
-				//ran into a wall, bounce / slide along it:
-				glm::vec3 const &a = walkmesh->vertices[player1.at.indices.x];
-				glm::vec3 const &b = walkmesh->vertices[player1.at.indices.y];
-				glm::vec3 const &c = walkmesh->vertices[player1.at.indices.z];
-				glm::vec3 along = glm::normalize(b-a);
-				glm::vec3 normal = glm::normalize(glm::cross(b-a, c-a));
-				glm::vec3 in = glm::cross(normal, along);
-
-				//check how much 'remain' is pointing out of the triangle:
-				float d = glm::dot(remain1, in);
-				if (d < 0.0f) {
-					//bounce off of the wall:
-					remain1 += (-1.25f * d) * in;
-				} else {
-					//if it's just pointing along the edge, bend slightly away from wall:
-					remain1 += 0.01f * d * in;
-				}
-			}
-		}
-		if (remain1 != glm::vec3(0.0f)) {
-			std::cout << "NOTE: code used full iteration budget for walking." << std::endl;
-		}
-		for (uint32_t iter = 0; iter < 10; ++iter) {
-			if (remain2 == glm::vec3(0.0f)) break;
-			WalkPoint end;
-			float time;
-			walkmesh->walk_in_triangle(player2.at, remain2, &end, &time);
-			player2.at = end;
-			if (time == 1.0f) {
-				//finished within triangle:
-				remain2 = glm::vec3(0.0f);
-				break;
-			}
-			//some step remains:
-			remain2 *= (1.0f - time);
-			//try to step over edge:
-			glm::quat rotation;
-			if (walkmesh->cross_edge(player2.at, &end, &rotation)) {
-				//stepped to a new triangle:
-				player2.at = end;
-				//rotate step to follow surface:
-				remain2 = rotation * remain2;
-			}
-			else {
-				//ran into a wall, bounce / slide along it:
-				glm::vec3 const& a = walkmesh->vertices[player2.at.indices.x];
-				glm::vec3 const& b = walkmesh->vertices[player2.at.indices.y];
-				glm::vec3 const& c = walkmesh->vertices[player2.at.indices.z];
-				glm::vec3 along = glm::normalize(b - a);
-				glm::vec3 normal = glm::normalize(glm::cross(b - a, c - a));
-				glm::vec3 in = glm::cross(normal, along);
-
-				//check how much 'remain' is pointing out of the triangle:
-				float d = glm::dot(remain2, in);
-				if (d < 0.0f) {
-					//bounce off of the wall:
-					remain2 += (-1.25f * d) * in;
-				}
-				else {
-					//if it's just pointing along the edge, bend slightly away from wall:
-					remain2 += 0.01f * d * in;
-				}
-			}
-		}
-		if (remain2 != glm::vec3(0.0f)) {
+		glm::vec3 steps[2] = {
+			player1.transform->get_local_to_world() * glm::vec4(move1.x, move1.y, 0.0f, 0.0f),
+			player2.transform->get_local_to_world() * glm::vec4(move2.x, move2.y, 0.0f, 0.0f)
+		};
+
+		//walk both players over the walkmesh in one batch:
+		WalkPoint ats[2] = { player1.at, player2.at };
+		if (walkmesh->walk_batch(ats, steps, 2) != 0) {
 			std::cout << "NOTE: code used full iteration budget for walking." << std::endl;
 		}
+		player1.at = ats[0];
+		player2.at = ats[1];
 
 		//update player's position to respect walking:
 		player1.transform->position = walkmesh->to_world_point(player1.at);
@@ -325,13 +261,7 @@ void PlayMode::draw(glm::uvec2 const &drawable_size) {
 	//update camera aspect ratio for drawable:
 	camera->aspect = float(drawable_size.x) / float(drawable_size.y);
 
-	//set up light type and position for lit_color_texture_program:
-	// TODO: consider using the Light(s) in the scene to do this
-	glUseProgram(lit_color_texture_program->program);
-	glUniform1i(lit_color_texture_program->LIGHT_TYPE_int, 1);
-	glUniform3fv(lit_color_texture_program->LIGHT_DIRECTION_vec3, 1, glm::value_ptr(glm::vec3(0.0f, 0.0f, -1.0f)));
-	glUniform3fv(lit_color_texture_program->LIGHT_ENERGY_vec3, 1, glm::value_ptr(glm::vec3(1000.0f, 1000.0f, 1000.0f)));
-	glUseProgram(0);
+	//(scene.draw() shades with the scene's lights)
 
 	glClearColor(0.5f, 0.5f, 0.5f, 1.0f);
 	glClearDepth(1.0f); //1.0 is actually the default value to clear the depth buffer to, but FYI you can change it.
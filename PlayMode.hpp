@@ -27,6 +27,8 @@ struct PlayMode : Mode {
 
 	//local copy of the game scene (so code can change it during gameplay):
 	Scene scene;
+	//state of the scene at the start of a round (restored on restart):
+	Scene::Snapshot start_state;
 
 	//player info:
 	struct Player {
@@ -1,11 +1,28 @@
 #include "Scene.hpp"
 
 #include "gl_errors.hpp"
+#include "Mesh.hpp"
+#include "WorkerPool.hpp"
 #include "read_write_chunk.hpp"
 
 #include <glm/gtc/type_ptr.hpp>
 
 #include <fstream>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <atomic>
+#include <algorithm>
+#include <iterator>
+#include <thread>
+
+//use SSE to test bounding boxes against the view frustum four at a time where available:
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SCENE_SSE 1
+#include <emmintrin.h>
+#else
+#define SCENE_SSE 0
+#endif
 
 //-------------------------
 
@@ -71,25 +88,455 @@ glm::mat4x3 Scene::Transform::make_world_to_local() const {
 	}
 }
 
+//source of globally unique cache generations and pass numbers:
+// (unique across transforms, so a re-parented transform can't mistake a new parent's generation for the old one's)
+static std::atomic< uint64_t > transform_cache_counter(0);
+
+uint64_t Scene::Transform::update_cache(uint64_t pass) const {
+	if (pass != 0 && cache.pass == pass) return cache.generation;
+
+	uint64_t parent_generation = (parent ? parent->update_cache(pass) : 0);
+	refresh_cache(parent_generation, pass);
+	return cache.generation;
+}
+
+void Scene::Transform::refresh_cache(uint64_t parent_generation, uint64_t pass) const {
+	if (cache.generation == 0
+	 || cache.position != position
+	 || cache.rotation != rotation
+	 || cache.scale != scale
+	 || cache.parent != parent
+	 || cache.parent_generation != parent_generation) {
+		//something changed, recompute (using parent's cached matrices rather than recursing):
+		if (!parent) {
+			cache.local_to_world = make_local_to_parent();
+			cache.world_to_local = make_parent_to_local();
+		} else {
+			cache.local_to_world = parent->cache.local_to_world * glm::mat4(make_local_to_parent());
+			cache.world_to_local = make_parent_to_local() * glm::mat4(parent->cache.world_to_local);
+		}
+		cache.normal_to_world = glm::inverse(glm::transpose(glm::mat3(cache.local_to_world)));
+		cache.position = position;
+		cache.rotation = rotation;
+		cache.scale = scale;
+		cache.parent = parent;
+		cache.parent_generation = parent_generation;
+		cache.generation = ++transform_cache_counter;
+	}
+	cache.pass = pass;
+}
+
+glm::mat4x3 const &Scene::Transform::get_local_to_world() const {
+	update_cache();
+	return cache.local_to_world;
+}
+
+glm::mat4x3 const &Scene::Transform::get_world_to_local() const {
+	update_cache();
+	return cache.world_to_local;
+}
+
+uint64_t Scene::update_transforms() const {
+	uint64_t pass = ++transform_cache_counter;
+
+	uint32_t threads = update_threads;
+	if (threads == 0) threads = std::max(1U, std::thread::hardware_concurrency());
+	if (threads == 1 || transforms.size() < 2 * UpdateMinPerThread) {
+		for (auto const &transform : transforms) {
+			transform.update_cache(pass);
+		}
+		return pass;
+	}
+
+	//mark the transforms in the list (depth -1U == not yet known):
+	for (auto const &transform : transforms) {
+		transform.cache.depth_pass = pass;
+		transform.cache.depth = -1U;
+	}
+
+	//find depths, counting only ancestors in the list:
+	// (a transform whose parent is elsewhere is at depth 0; its parent is brought up to date here, before the levels)
+	std::vector< Transform const * > chain;
+	uint32_t levels = 0;
+	for (auto const &transform : transforms) {
+		Transform const *at = &transform;
+		while (at->cache.depth == -1U && at->parent && at->parent->cache.depth_pass == pass) {
+			chain.emplace_back(at);
+			at = at->parent;
+		}
+		if (at->cache.depth == -1U) {
+			if (at->parent) at->parent->update_cache(pass);
+			at->cache.depth = 0;
+		}
+		uint32_t depth = at->cache.depth;
+		while (!chain.empty()) {
+			chain.back()->cache.depth = ++depth;
+			chain.pop_back();
+		}
+		levels = std::max(levels, transform.cache.depth + 1);
+	}
+
+	//group by depth (counting sort):
+	update_level_begin.assign(levels + 1, 0);
+	for (auto const &transform : transforms) {
+		update_level_begin[transform.cache.depth + 1] += 1;
+	}
+	for (uint32_t d = 0; d < levels; ++d) {
+		update_level_begin[d + 1] += update_level_begin[d];
+	}
+	update_order.resize(transforms.size());
+	{
+		std::vector< uint32_t > fill(update_level_begin.begin(), update_level_begin.end() - 1);
+		for (auto const &transform : transforms) {
+			update_order[fill[transform.cache.depth]++] = &transform;
+		}
+	}
+
+	//update one level at a time -- every parent in the list was finished a level earlier, so nothing recurses:
+	for (uint32_t d = 0; d < levels; ++d) {
+		uint32_t begin = update_level_begin[d];
+		uint32_t count = update_level_begin[d + 1] - begin;
+		auto update_range = [this, pass](uint32_t range_begin, uint32_t range_end) {
+			for (uint32_t i = range_begin; i < range_end; ++i) {
+				Transform const &transform = *update_order[i];
+				transform.refresh_cache(transform.parent ? transform.parent->cache.generation : 0, pass);
+			}
+		};
+		uint32_t chunks = uint32_t(std::min< size_t >(threads, count / UpdateMinPerThread));
+		if (chunks <= 1) {
+			update_range(begin, begin + count);
+		} else {
+			WorkerPool::shared().run(chunks, [&](uint32_t c) {
+				update_range(begin + uint32_t(uint64_t(count) * c / chunks), begin + uint32_t(uint64_t(count) * (c + 1) / chunks));
+			});
+		}
+	}
+
+#ifndef NDEBUG
+	//every 64th multi-threaded pass, make sure it matched the single-threaded arithmetic:
+	threaded_updates += 1;
+	if (threaded_updates % 64 == 1) {
+		assert(check_transforms() && "multi-threaded update_transforms() should match update_cache()");
+	}
+#endif
+
+	return pass;
+}
+
+bool Scene::check_transforms() const {
+	for (auto const &transform : transforms) {
+		//as per Transform::refresh_cache():
+		glm::mat4x3 local_to_world, world_to_local;
+		if (!transform.parent) {
+			local_to_world = transform.make_local_to_parent();
+			world_to_local = transform.make_parent_to_local();
+		} else {
+			local_to_world = transform.parent->cache.local_to_world * glm::mat4(transform.make_local_to_parent());
+			world_to_local = transform.make_parent_to_local() * glm::mat4(transform.parent->cache.world_to_local);
+		}
+		glm::mat3 normal_to_world = glm::inverse(glm::transpose(glm::mat3(local_to_world)));
+		//(compared bytewise, so results must match exactly -- NaNs included)
+		if (std::memcmp(&local_to_world, &transform.cache.local_to_world, sizeof(local_to_world)) != 0
+		 || std::memcmp(&world_to_local, &transform.cache.world_to_local, sizeof(world_to_local)) != 0
+		 || std::memcmp(&normal_to_world, &transform.cache.normal_to_world, sizeof(normal_to_world)) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+//-------------------------
+
+void Scene::Drawable::set_mesh(MeshBuffer const &buffer, std::string const &name) {
+	Mesh const &mesh = buffer.lookup(name);
+
+	pipeline.type = mesh.type;
+	pipeline.start = mesh.start;
+	pipeline.count = mesh.count;
+	pipeline.index_type = mesh.index_type;
+	pipeline.index_start = mesh.index_start;
+	pipeline.index_count = mesh.index_count;
+	pipeline.position_offset = mesh.position_offset;
+	pipeline.position_scale = mesh.position_scale;
+
+	min = mesh.min;
+	max = mesh.max;
+
+	//simpler levels of detail (if the mesh has them), each used below half the screen size of the one before:
+	lod_count = std::min(buffer.lod_count(name) - 1, uint32_t(MaxLODs));
+	for (uint32_t l = 1; l <= lod_count; ++l) {
+		Mesh const &lod = buffer.lookup(name, l);
+		lods[l-1].index_start = lod.index_start;
+		lods[l-1].index_count = lod.index_count;
+		lods[l-1].screen_size = 0.5f / float(1U << l);
+	}
+}
+
 //-------------------------
 
 glm::mat4 Scene::Camera::make_projection() const {
 	return glm::infinitePerspective( fovy, aspect, near );
 }
 
+float Scene::Light::make_range() const {
+	//lights fall off as energy / distance^2:
+	float brightest = std::max(energy.x, std::max(energy.y, energy.z));
+	return std::sqrt(std::max(brightest, 0.0f) * 256.0f);
+}
+
 //-------------------------
 
 
 void Scene::draw(Camera const &camera) const {
 	assert(camera.transform);
-	glm::mat4 world_to_clip = camera.make_projection() * glm::mat4(camera.transform->make_world_to_local());
+	glm::mat4 world_to_clip = camera.make_projection() * glm::mat4(camera.transform->get_world_to_local());
 	glm::mat4x3 world_to_light = glm::mat4x3(1.0f);
 	draw(world_to_clip, world_to_light);
 }
 
+//four world-space bounding boxes, as center and half-extent (structure-of-arrays so they can be tested together):
+struct BoxPacket {
+	float cx[4], cy[4], cz[4];
+	float ex[4], ey[4], ez[4];
+};
+
+//set bit i of the result if box i is entirely on the negative side of any of the (unnormalized) planes:
+// (box is outside a plane if dot(n, center) + w + dot(|n|, extent) < 0)
+#if SCENE_SSE
+static uint32_t boxes_outside(glm::vec4 const (&planes)[6], BoxPacket const &boxes) {
+	__m128 cx = _mm_loadu_ps(boxes.cx), cy = _mm_loadu_ps(boxes.cy), cz = _mm_loadu_ps(boxes.cz);
+	__m128 ex = _mm_loadu_ps(boxes.ex), ey = _mm_loadu_ps(boxes.ey), ez = _mm_loadu_ps(boxes.ez);
+	__m128 outside = _mm_setzero_ps();
+	for (glm::vec4 const &plane : planes) {
+		__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(plane.x)), _mm_mul_ps(cy, _mm_set1_ps(plane.y))), _mm_add_ps(_mm_mul_ps(cz, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w)));
+		__m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ex, _mm_set1_ps(std::abs(plane.x))), _mm_mul_ps(ey, _mm_set1_ps(std::abs(plane.y)))), _mm_mul_ps(ez, _mm_set1_ps(std::abs(plane.z))));
+		outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(d, r), _mm_setzero_ps()));
+	}
+	return uint32_t(_mm_movemask_ps(outside));
+}
+#else
+static uint32_t boxes_outside(glm::vec4 const (&planes)[6], BoxPacket const &boxes) {
+	uint32_t outside = 0;
+	for (uint32_t lane = 0; lane < 4; ++lane) {
+		for (glm::vec4 const &plane : planes) {
+			float d = (boxes.cx[lane] * plane.x + boxes.cy[lane] * plane.y) + (boxes.cz[lane] * plane.z + plane.w);
+			float r = (boxes.ex[lane] * std::abs(plane.x) + boxes.ey[lane] * std::abs(plane.y)) + boxes.ez[lane] * std::abs(plane.z);
+			if (d + r < 0.0f) outside |= (1U << lane);
+		}
+	}
+	return outside;
+}
+#endif
+
+//can drawables with this pipeline be drawn together with one instanced draw call?
+static bool instanceable(Scene::Drawable::Pipeline const &pipeline) {
+	return pipeline.instanced_program != 0 && pipeline.instanced_vao != 0;
+}
+
+//would drawables with these pipelines draw the same thing (aside from transform)?
+static bool same_instanced_pipeline(Scene::Drawable::Pipeline const &a, Scene::Drawable::Pipeline const &b) {
+	if (a.instanced_program != b.instanced_program || a.instanced_vao != b.instanced_vao) return false;
+	if (a.type != b.type || a.start != b.start || a.count != b.count) return false;
+	if (a.index_type != b.index_type || a.index_start != b.index_start || a.index_count != b.index_count) return false;
+	if (a.material != b.material) return false;
+	for (uint32_t i = 0; i < Scene::Drawable::Pipeline::TextureCount; ++i) {
+		if (a.textures[i].texture != b.textures[i].texture || a.textures[i].target != b.textures[i].target) return false;
+	}
+	return true;
+}
+
+//index range to draw for a drawable at a level of detail (0 is the pipeline's own range, i is lods[i-1]):
+static void get_lod_range(Scene::Drawable const &drawable, uint32_t lod, GLuint *index_start, GLuint *index_count) {
+	assert(index_start && index_count);
+	if (lod == 0) {
+		*index_start = drawable.pipeline.index_start;
+		*index_count = drawable.pipeline.index_count;
+	} else {
+		assert(lod <= drawable.lod_count && lod <= Scene::Drawable::MaxLODs);
+		*index_start = drawable.lods[lod-1].index_start;
+		*index_count = drawable.lods[lod-1].index_count;
+	}
+}
+
+//render queue sort key -- program, then vertex array, then textures and material, then depth (near to far):
+//  [63..52] program  [51..40] vao  [39..24] texture + material hash  [23..0] depth
+// (names are truncated/hashed, so unrelated state can share a key; that only costs a redundant state change)
+// instanceable drawables use their instanced program and vao, and a hash of their vertex range (and the index_start
+// of the level of detail drawn) in place of depth, so that drawables of the same mesh end up next to each other
+static uint64_t make_sort_key(Scene::Drawable::Pipeline const &pipeline, GLuint index_start, float depth) {
+	uint64_t textures = 0;
+	for (uint32_t i = 0; i < Scene::Drawable::Pipeline::TextureCount; ++i) {
+		textures = textures * 0x9e3779b1ULL + pipeline.textures[i].texture;
+	}
+	textures = textures * 0x9e3779b1ULL + pipeline.material;
+	textures = (textures ^ (textures >> 16) ^ (textures >> 32)) & 0xffff;
+
+	if (instanceable(pipeline)) {
+		uint64_t range = (uint64_t(pipeline.start) * 0x9e3779b1ULL + pipeline.count) * 0x9e3779b1ULL + pipeline.type;
+		range = range * 0x9e3779b1ULL + index_start;
+		range = (range ^ (range >> 24) ^ (range >> 48)) & 0xffffff;
+		return (uint64_t(pipeline.instanced_program & 0xfff) << 52)
+		     | (uint64_t(pipeline.instanced_vao & 0xfff) << 40)
+		     | (textures << 24)
+		     | range;
+	}
+
+	//the bit pattern of a non-negative float increases with its value, so the high bits work as a coarse depth:
+	uint32_t depth_bits = 0;
+	if (depth > 0.0f) std::memcpy(&depth_bits, &depth, sizeof(depth_bits));
+
+	return (uint64_t(pipeline.program & 0xfff) << 52)
+	     | (uint64_t(pipeline.vao & 0xfff) << 40)
+	     | (textures << 24)
+	     | uint64_t(depth_bits >> 8);
+}
+
+//buffers that per-frame data is streamed through (shared by all scenes; created on first use):
+static GLuint instance_buffer = 0; //per-instance attributes
+static GLuint frame_buffer = 0; //"Frame" block
+static GLuint draw_buffer = 0; //"Draw" block (one aligned slot per drawable)
+static GLuint default_material = 0; //"Material" block for pipelines without a material
+static GLuint light_buffer = 0, light_texture = 0; //LIGHTS
+static GLuint cluster_buffer = 0, cluster_texture = 0; //CLUSTERS
+static GLuint light_index_buffer = 0, light_index_texture = 0; //LIGHT_INDICES
+
+void Scene::bind_uniform_blocks(GLuint program) {
+	auto bind = [&](char const *name, GLuint binding) {
+		GLuint index = glGetUniformBlockIndex(program, name);
+		if (index == GL_INVALID_INDEX) return; //(program doesn't use this block)
+		glUniformBlockBinding(program, index, binding);
+	};
+	bind("Frame", FrameBinding);
+	bind("Material", MaterialBinding);
+	bind("Draw", DrawBinding);
+}
+
+void Scene::bind_light_samplers(GLuint program) {
+	glUseProgram(program);
+	auto bind = [&](char const *name, GLuint unit) {
+		GLint location = glGetUniformLocation(program, name);
+		if (location == -1) return; //(program doesn't use this sampler)
+		glUniform1i(location, GLint(unit));
+	};
+	bind("LIGHTS", LightsUnit);
+	bind("CLUSTERS", ClustersUnit);
+	bind("LIGHT_INDICES", LightIndicesUnit);
+	glUseProgram(0);
+}
+
+GLuint Scene::make_material(MaterialUniforms const &material) {
+	GLuint buffer = 0;
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(MaterialUniforms), &material, GL_STATIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	return buffer;
+}
+
+//per-instance matrix attributes (each takes one location per column):
+struct InstanceMatrix {
+	char const *name;
+	GLint columns, rows;
+	size_t offset;
+};
+static InstanceMatrix const instance_matrices[] = {
+	{ "OBJECT_TO_CLIP", 4, 4, offsetof(Scene::InstanceData, object_to_clip) },
+	{ "OBJECT_TO_LIGHT", 4, 3, offsetof(Scene::InstanceData, object_to_light) },
+	{ "NORMAL_TO_LIGHT", 3, 3, offsetof(Scene::InstanceData, normal_to_light) },
+};
+
+std::vector< GLuint > Scene::bind_instance_attributes(GLuint program) {
+	std::vector< GLuint > bound;
+
+	if (instance_buffer == 0) glGenBuffers(1, &instance_buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+
+	for (InstanceMatrix const &matrix : instance_matrices) {
+		GLint location = glGetAttribLocation(program, matrix.name);
+		if (location == -1) continue; //(program doesn't use this matrix, or has it as a uniform)
+		for (GLint c = 0; c < matrix.columns; ++c) {
+			GLuint index = GLuint(location + c);
+			glVertexAttribPointer(index, matrix.rows, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (GLbyte *)0 + matrix.offset + c * matrix.rows * sizeof(float));
+			glEnableVertexAttribArray(index);
+			glVertexAttribDivisor(index, 1);
+			bound.emplace_back(index);
+		}
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	return bound;
+}
+
+std::vector< GLuint > Scene::instance_attribute_locations(GLuint program) {
+	std::vector< GLuint > locations;
+	for (InstanceMatrix const &matrix : instance_matrices) {
+		GLint location = glGetAttribLocation(program, matrix.name);
+		if (location == -1) continue;
+		for (GLint c = 0; c < matrix.columns; ++c) {
+			locations.emplace_back(GLuint(location + c));
+		}
+	}
+	return locations;
+}
+
+GLuint Scene::make_instanced_vao(MeshBuffer const &buffer, GLuint program) {
+	GLuint vao = buffer.make_vao_for_program(program, instance_attribute_locations(program));
+	glBindVertexArray(vao);
+	bind_instance_attributes(program);
+	glBindVertexArray(0);
+	return vao;
+}
+
 void Scene::draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light) const {
 
-	//Iterate through all drawables, sending each one to OpenGL:
+	//refresh world matrices of anything that moved:
+	uint64_t pass = update_transforms();
+
+	//normals go to light space via the inverse transpose of world_to_light (skipped in the usual, identity, case):
+	bool light_is_world = (world_to_light == glm::mat4x3(1.0f));
+	glm::mat3 world_normal_to_light = glm::inverse(glm::transpose(glm::mat3(world_to_light)));
+
+	//frustum planes (in world space) from the rows of world_to_clip -- points inside have -w <= x,y,z <= w:
+	glm::mat4 rows = glm::transpose(world_to_clip);
+
+	//clip-space y per unit of world-space distance (across the view direction), for measuring sizes on screen:
+	// (the viewport is 2 w tall in clip space, so a sphere of radius r is about r * clip_per_unit / w of it across)
+	float clip_per_unit = glm::length(glm::vec3(rows[1]));
+	glm::vec4 planes[6];
+	planes[0] = rows[3] + rows[0]; //left
+	planes[1] = rows[3] - rows[0]; //right
+	planes[2] = rows[3] + rows[1]; //bottom
+	planes[3] = rows[3] - rows[1]; //top
+	planes[4] = rows[3] + rows[2]; //near
+	planes[5] = rows[3] - rows[2]; //far
+
+	draw_stats = DrawStats();
+	render_queue.clear();
+
+	//drawables are culled in batches of four; visible ones go into the render queue:
+	Drawable const *batch[4];
+	float batch_depth[4];
+	uint32_t batch_lod[4];
+	uint32_t batch_size = 0;
+	uint32_t batch_bounded = 0; //bit i set if batch[i] has bounds (and so can be culled)
+	BoxPacket boxes = BoxPacket();
+
+	auto flush_batch = [&]() {
+		uint32_t outside = boxes_outside(planes, boxes) & batch_bounded;
+		for (uint32_t i = 0; i < batch_size; ++i) {
+			if (outside & (1U << i)) {
+				draw_stats.culled += 1;
+			} else {
+				GLuint index_start, index_count;
+				get_lod_range(*batch[i], batch_lod[i], &index_start, &index_count);
+				render_queue.emplace_back(DrawPacket{make_sort_key(batch[i]->pipeline, index_start, batch_depth[i]), batch[i], 1, 0, batch_lod[i]});
+			}
+		}
+		batch_size = 0;
+		batch_bounded = 0;
+	};
+
 	for (auto const &drawable : drawables) {
 		//Reference to drawable's pipeline for convenience:
 		Scene::Drawable::Pipeline const &pipeline = drawable.pipeline;
@@ -100,64 +547,357 @@ void Scene::draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_lig
 		if (pipeline.vao == 0) continue;
 		//skip any drawables that don't contain any vertices:
 		if (pipeline.count == 0) continue;
+		if (pipeline.index_type != GL_NONE && pipeline.index_count == 0) continue;
 
+		assert(drawable.transform); //drawables *must* have a transform
+		drawable.transform->update_cache(pass); //(no-op unless transform isn't in this scene's list)
+		glm::mat4x3 const &object_to_world = drawable.transform->cache.local_to_world;
+
+		//world-space box around the object-space box:
+		// (center transforms as a point; extent along each world axis is the sum of |matrix| times extent)
+		glm::vec3 center = object_to_world[3];
+		glm::vec3 extent = glm::vec3(0.0f);
+		if (drawable.min.x <= drawable.max.x && drawable.min.y <= drawable.max.y && drawable.min.z <= drawable.max.z) {
+			center = object_to_world * glm::vec4(0.5f * (drawable.max + drawable.min), 1.0f);
+			glm::vec3 half = 0.5f * (drawable.max - drawable.min);
+			extent = glm::abs(object_to_world[0]) * half.x + glm::abs(object_to_world[1]) * half.y + glm::abs(object_to_world[2]) * half.z;
+			batch_bounded |= (1U << batch_size);
+		}
+		boxes.cx[batch_size] = center.x; boxes.cy[batch_size] = center.y; boxes.cz[batch_size] = center.z;
+		boxes.ex[batch_size] = extent.x; boxes.ey[batch_size] = extent.y; boxes.ez[batch_size] = extent.z;
+		batch[batch_size] = &drawable;
+		batch_depth[batch_size] = glm::dot(rows[3], glm::vec4(center, 1.0f)); //(clip-space w == distance along view direction)
+
+		//level of detail, from the size on screen of a sphere around the (world-space) box:
+		batch_lod[batch_size] = 0;
+		if (drawable.lod_count != 0 && pipeline.index_type != GL_NONE && (batch_bounded & (1U << batch_size))) {
+			float radius = glm::length(extent);
+			float depth = batch_depth[batch_size];
+			if (depth > radius) { //(otherwise the camera is inside or close to the sphere)
+				float screen_size = radius * clip_per_unit / depth;
+				for (uint32_t i = 0; i < std::min(drawable.lod_count, uint32_t(Drawable::MaxLODs)); ++i) {
+					if (screen_size < drawable.lods[i].screen_size) batch_lod[batch_size] = i + 1;
+				}
+			}
+		}
+		batch_size += 1;
 
-		//Set shader program:
-		glUseProgram(pipeline.program);
-
-		//Set attribute sources:
-		glBindVertexArray(pipeline.vao);
-
-		//Configure program uniforms:
+		if (batch_size == 4) flush_batch();
+	}
+	if (batch_size != 0) {
+		//(unused lanes hold stale boxes, but aren't drawn or counted)
+		flush_batch();
+	}
 
-		//the object-to-world matrix is used in all three of these uniforms:
-		assert(drawable.transform); //drawables *must* have a transform
-		glm::mat4x3 object_to_world = drawable.transform->make_local_to_world();
+	//sort so that drawables with the same state are adjacent:
+	std::sort(render_queue.begin(), render_queue.end(), [](DrawPacket const &a, DrawPacket const &b) {
+		return a.key < b.key;
+	});
+
+	//per-frame buffers:
+	if (frame_buffer == 0) {
+		glGenBuffers(1, &frame_buffer);
+		glGenBuffers(1, &draw_buffer);
+		default_material = make_material(MaterialUniforms());
+		glGenBuffers(1, &light_buffer);
+		glGenTextures(1, &light_texture);
+		glGenBuffers(1, &cluster_buffer);
+		glGenTextures(1, &cluster_texture);
+		glGenBuffers(1, &light_index_buffer);
+		glGenTextures(1, &light_index_texture);
+	}
 
-		//OBJECT_TO_CLIP takes vertices from object space to clip space:
-		if (pipeline.OBJECT_TO_CLIP_mat4 != -1U) {
-			glm::mat4 object_to_clip = world_to_clip * glm::mat4(object_to_world);
-			glUniformMatrix4fv(pipeline.OBJECT_TO_CLIP_mat4, 1, GL_FALSE, glm::value_ptr(object_to_clip));
+	//lights -- global ones first, then point and spot lights (which are binned into clusters by their bounding spheres):
+	light_data.clear();
+	light_spheres.clear();
+	glm::mat3 world_to_light_3 = glm::mat3(world_to_light);
+	auto add_light = [&](Light const &light, float type, glm::vec3 const &position, glm::vec3 const &direction) {
+		float cutoff = std::cos(0.5f * light.spot_fov);
+		glm::vec3 light_position = world_to_light * glm::vec4(position, 1.0f);
+		glm::vec3 light_direction = light_is_world ? direction : glm::normalize(world_to_light_3 * direction);
+		light_data.emplace_back(light_position, type);
+		light_data.emplace_back(light_direction, cutoff);
+		light_data.emplace_back(light.energy, light.make_range());
+	};
+	uint32_t global_lights = 0;
+	for (bool globals : { true, false }) {
+		for (auto const &light : lights) {
+			if (globals != (light.type == Light::Hemisphere || light.type == Light::Directional)) continue;
+
+			assert(light.transform);
+			light.transform->update_cache(pass);
+			glm::mat4x3 const &light_to_world = light.transform->cache.local_to_world;
+			glm::vec3 position = light_to_world[3];
+			glm::vec3 direction = -glm::normalize(light_to_world[2]); //(lights point along their -z axis)
+
+			if (light.type == Light::Hemisphere) {
+				add_light(light, 1.0f, position, direction);
+				global_lights += 1;
+			} else if (light.type == Light::Directional) {
+				add_light(light, 3.0f, position, direction);
+				global_lights += 1;
+			} else if (light.type == Light::Point) {
+				add_light(light, 0.0f, position, direction);
+				light_spheres.emplace_back(LightClusters::Sphere{position, light.make_range()});
+			} else if (light.type == Light::Spot) {
+				add_light(light, 2.0f, position, direction);
+				//smallest sphere around the cone:
+				// wide cones are bounded by the circle at their end, narrow cones by a sphere through the tip and that circle
+				float range = light.make_range();
+				float half_angle = 0.5f * light.spot_fov;
+				if (half_angle > glm::radians(45.0f)) {
+					light_spheres.emplace_back(LightClusters::Sphere{position + direction * (range * std::cos(half_angle)), range * std::sin(half_angle)});
+				} else {
+					float radius = range / (2.0f * std::cos(half_angle));
+					light_spheres.emplace_back(LightClusters::Sphere{position + direction * radius, radius});
+				}
+			}
 		}
+	}
+	light_clusters.build(world_to_clip, light_spheres, light_cluster_threads);
+	if (light_data.empty()) light_data.emplace_back(0.0f); //(buffer textures can't be empty)
+	if (light_clusters.indices.empty()) light_clusters.indices.emplace_back(0);
+
+	//upload to buffer textures, which stay bound (on their own units) until the end of draw():
+	auto upload_buffer_texture = [](GLuint unit, GLuint buffer, GLuint texture, GLenum format, size_t size, void const *data) {
+		glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+		glBufferData(GL_TEXTURE_BUFFER, size, data, GL_STREAM_DRAW);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+		glActiveTexture(GL_TEXTURE0 + unit);
+		glBindTexture(GL_TEXTURE_BUFFER, texture);
+		glTexBuffer(GL_TEXTURE_BUFFER, format, buffer);
+	};
+	upload_buffer_texture(LightsUnit, light_buffer, light_texture, GL_RGBA32F, light_data.size() * sizeof(glm::vec4), light_data.data());
+	upload_buffer_texture(ClustersUnit, cluster_buffer, cluster_texture, GL_RG32UI, light_clusters.clusters.size() * sizeof(glm::uvec2), light_clusters.clusters.data());
+	upload_buffer_texture(LightIndicesUnit, light_index_buffer, light_index_texture, GL_R32UI, light_clusters.indices.size() * sizeof(uint32_t), light_clusters.indices.data());
+	glActiveTexture(GL_TEXTURE0);
+
+	//per-frame uniforms:
+	{
+		FrameUniforms frame;
+		frame.world_to_clip = world_to_clip;
+		frame.cluster_counts = glm::uvec4(LightClusters::X, LightClusters::Y, LightClusters::Z, global_lights);
+		frame.cluster_depth = glm::vec4(light_clusters.near, light_clusters.depth_scale, 0.0f, 0.0f);
+		glBindBuffer(GL_UNIFORM_BUFFER, frame_buffer);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), &frame, GL_STREAM_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		glBindBufferBase(GL_UNIFORM_BUFFER, FrameBinding, frame_buffer);
+	}
 
-		//the object-to-light matrix is used in the next two uniforms:
-		glm::mat4x3 object_to_light = world_to_light * glm::mat4(object_to_world);
+	//the per-drawable transforms, whether they end up in the "Draw" block or in per-instance attributes:
+	auto make_transforms = [&](Drawable const &drawable, glm::mat4 *object_to_clip, glm::mat4x3 *object_to_light, glm::mat3 *normal_to_light) {
+		//the object-to-world matrix is used in all three of these:
+		glm::mat4x3 const &object_to_world = drawable.transform->cache.local_to_world;
+		//..and vertex positions may need decoding first (folded into the matrix, so shaders needn't know):
+		Drawable::Pipeline const &pipeline = drawable.pipeline;
+		glm::mat4x3 vertex_to_world = object_to_world;
+		if (pipeline.position_offset != glm::vec3(0.0f) || pipeline.position_scale != glm::vec3(1.0f)) {
+			vertex_to_world[0] *= pipeline.position_scale.x;
+			vertex_to_world[1] *= pipeline.position_scale.y;
+			vertex_to_world[2] *= pipeline.position_scale.z;
+			vertex_to_world[3] = object_to_world * glm::vec4(pipeline.position_offset, 1.0f);
+		}
+		//OBJECT_TO_CLIP takes vertices from object space to clip space:
+		*object_to_clip = world_to_clip * glm::mat4(vertex_to_world);
+		//OBJECT_TO_LIGHT takes vertices from object space to light space:
+		*object_to_light = world_to_light * glm::mat4(vertex_to_world);
+		//NORMAL_TO_LIGHT takes normals from object space to light space:
+		// (inverse transpose of object_to_light == that of world_to_light times the cached one of object_to_world)
+		*normal_to_light = drawable.transform->cache.normal_to_world;
+		if (!light_is_world) *normal_to_light = world_normal_to_light * *normal_to_light;
+	};
 
-		//OBJECT_TO_CLIP takes vertices from object space to light space:
-		if (pipeline.OBJECT_TO_LIGHT_mat4x3 != -1U) {
-			glUniformMatrix4x3fv(pipeline.OBJECT_TO_LIGHT_mat4x3, 1, GL_FALSE, glm::value_ptr(object_to_light));
+	//find instanced runs, and write "Draw" blocks for everything else (all uploaded at once):
+	// render_queue[p].instances becomes the size of the run starting at p (1 if not instanced, 0 inside a run)
+	static GLint slot_alignment = 0;
+	if (slot_alignment == 0) {
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &slot_alignment);
+		slot_alignment = std::max(slot_alignment, 1);
+	}
+	size_t const slot_size = (sizeof(DrawUniforms) + slot_alignment - 1) / slot_alignment * slot_alignment;
+	draw_uniforms.clear();
+	for (size_t p = 0; p < render_queue.size(); /* later */) {
+		Drawable::Pipeline const &pipeline = render_queue[p].drawable->pipeline;
+		uint32_t instances = 1;
+		if (instanceable(pipeline)) {
+			GLuint index_start, index_count;
+			get_lod_range(*render_queue[p].drawable, render_queue[p].lod, &index_start, &index_count);
+			while (p + instances < render_queue.size()
+			    && instanceable(render_queue[p + instances].drawable->pipeline)
+			    && same_instanced_pipeline(pipeline, render_queue[p + instances].drawable->pipeline)) {
+				//(drawables of the same mesh may be at different levels of detail)
+				GLuint next_start, next_count;
+				get_lod_range(*render_queue[p + instances].drawable, render_queue[p + instances].lod, &next_start, &next_count);
+				if (next_start != index_start || next_count != index_count) break;
+				render_queue[p + instances].instances = 0;
+				instances += 1;
+			}
 		}
+		render_queue[p].instances = instances;
+		if (instances == 1) {
+			render_queue[p].slot = uint32_t(draw_uniforms.size() / slot_size);
+			draw_uniforms.resize(draw_uniforms.size() + slot_size);
+			DrawUniforms draw;
+			glm::mat4x3 object_to_light;
+			glm::mat3 normal_to_light;
+			make_transforms(*render_queue[p].drawable, &draw.object_to_clip, &object_to_light, &normal_to_light);
+			draw.object_to_light = glm::mat4(object_to_light);
+			draw.normal_to_light = glm::mat3x4(glm::mat4(normal_to_light));
+			std::memcpy(draw_uniforms.data() + draw_uniforms.size() - slot_size, &draw, sizeof(draw));
+		}
+		p += instances;
+	}
+	if (!draw_uniforms.empty()) {
+		glBindBuffer(GL_UNIFORM_BUFFER, draw_buffer);
+		glBufferData(GL_UNIFORM_BUFFER, draw_uniforms.size(), draw_uniforms.data(), GL_STREAM_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
 
-		//NORMAL_TO_CLIP takes normals from object space to light space:
-		if (pipeline.NORMAL_TO_LIGHT_mat3 != -1U) {
-			glm::mat3 normal_to_light = glm::inverse(glm::transpose(glm::mat3(object_to_light)));
-			glUniformMatrix3fv(pipeline.NORMAL_TO_LIGHT_mat3, 1, GL_FALSE, glm::value_ptr(normal_to_light));
+	//currently-bound state (only changed when the next drawable needs something different):
+	GLuint bound_program = 0;
+	GLuint bound_vao = 0;
+	GLuint bound_material = 0;
+	uint32_t active_unit = 0;
+	Drawable::Pipeline::TextureInfo bound_textures[Drawable::Pipeline::TextureCount];
+
+	auto set_active_unit = [&](uint32_t unit) {
+		if (active_unit != unit) {
+			glActiveTexture(GL_TEXTURE0 + unit);
+			active_unit = unit;
+			draw_stats.state_changes += 1;
+		}
+	};
+	auto bind_texture = [&](uint32_t unit, Drawable::Pipeline::TextureInfo const &want) {
+		Drawable::Pipeline::TextureInfo &bound = bound_textures[unit];
+		if (bound.texture == want.texture && (bound.target == want.target || want.texture == 0)) return;
+		set_active_unit(unit);
+		//(a texture left on a different target would still be visible to shaders, so clear it)
+		if (bound.texture != 0 && bound.target != want.target) {
+			glBindTexture(bound.target, 0);
+			draw_stats.state_changes += 1;
+		}
+		glBindTexture(want.target, want.texture);
+		draw_stats.state_changes += 1;
+		bound = want;
+	};
+	auto use_program = [&](GLuint program) {
+		if (bound_program != program) {
+			glUseProgram(program);
+			bound_program = program;
+			draw_stats.state_changes += 1;
 		}
+	};
+	auto bind_vao = [&](GLuint vao) {
+		if (bound_vao != vao) {
+			glBindVertexArray(vao);
+			bound_vao = vao;
+			draw_stats.state_changes += 1;
+		}
+	};
+	auto bind_material = [&](GLuint material) {
+		if (material == 0) material = default_material;
+		if (bound_material != material) {
+			glBindBufferBase(GL_UNIFORM_BUFFER, MaterialBinding, material);
+			bound_material = material;
+			draw_stats.state_changes += 1;
+		}
+	};
 
-		//set any requested custom uniforms:
-		if (pipeline.set_uniforms) pipeline.set_uniforms();
+	for (size_t p = 0; p < render_queue.size(); p += render_queue[p].instances) {
+		Drawable const &drawable = *render_queue[p].drawable;
+		//Reference to drawable's pipeline for convenience:
+		Scene::Drawable::Pipeline const &pipeline = drawable.pipeline;
+		uint32_t instances = render_queue[p].instances;
+		assert(instances != 0);
+
+		//index range of the level of detail being drawn (same for all instances):
+		GLuint index_start, index_count;
+		get_lod_range(drawable, render_queue[p].lod, &index_start, &index_count);
+		if (render_queue[p].lod != 0) draw_stats.simplified += instances;
 
-		//set up textures:
+		//each drawable used to set program, vao, and (active unit + bind) twice per texture, then reset the active unit:
+		uint32_t naive_state_changes = 3;
 		for (uint32_t i = 0; i < Drawable::Pipeline::TextureCount; ++i) {
-			if (pipeline.textures[i].texture != 0) {
-				glActiveTexture(GL_TEXTURE0 + i);
-				glBindTexture(pipeline.textures[i].target, pipeline.textures[i].texture);
+			if (pipeline.textures[i].texture != 0) naive_state_changes += 4;
+		}
+		draw_stats.state_changes_saved += instances * naive_state_changes;
+
+		//set up textures and material (texture units the drawable doesn't use are left empty):
+		for (uint32_t i = 0; i < Drawable::Pipeline::TextureCount; ++i) {
+			bind_texture(i, pipeline.textures[i]);
+		}
+		bind_material(pipeline.material);
+
+		if (instances > 1) {
+			//Draw all the instances with one call:
+			use_program(pipeline.instanced_program);
+			bind_vao(pipeline.instanced_vao);
+
+			//stream transforms into the instance buffer (re-specifying the whole buffer lets the driver avoid a stall):
+			instance_data.resize(instances);
+			for (uint32_t i = 0; i < instances; ++i) {
+				InstanceData &data = instance_data[i];
+				make_transforms(*render_queue[p + i].drawable, &data.object_to_clip, &data.object_to_light, &data.normal_to_light);
+			}
+			glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+			glBufferData(GL_ARRAY_BUFFER, instances * sizeof(InstanceData), instance_data.data(), GL_STREAM_DRAW);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+			if (pipeline.index_type != GL_NONE) {
+				glDrawElementsInstancedBaseVertex(pipeline.type, GLsizei(index_count), pipeline.index_type, (GLbyte *)0 + index_start, GLsizei(instances), GLint(pipeline.start));
+			} else {
+				glDrawArraysInstanced(pipeline.type, pipeline.start, pipeline.count, GLsizei(instances));
 			}
+			draw_stats.drawn += instances;
+			draw_stats.instanced_batches += 1;
+			continue;
 		}
 
-		//draw the object:
-		glDrawArrays(pipeline.type, pipeline.start, pipeline.count);
+		//Set shader program:
+		use_program(pipeline.program);
 
-		//un-bind textures:
-		for (uint32_t i = 0; i < Drawable::Pipeline::TextureCount; ++i) {
-			if (pipeline.textures[i].texture != 0) {
-				glActiveTexture(GL_TEXTURE0 + i);
-				glBindTexture(pipeline.textures[i].target, 0);
+		//Set attribute sources:
+		bind_vao(pipeline.vao);
+
+		//Point the "Draw" block at this drawable's transforms:
+		glBindBufferRange(GL_UNIFORM_BUFFER, DrawBinding, draw_buffer, GLintptr(render_queue[p].slot * slot_size), sizeof(DrawUniforms));
+
+		//..or set them as plain uniforms, for programs that use those:
+		if (pipeline.OBJECT_TO_CLIP_mat4 != -1U || pipeline.OBJECT_TO_LIGHT_mat4x3 != -1U || pipeline.NORMAL_TO_LIGHT_mat3 != -1U) {
+			glm::mat4 object_to_clip;
+			glm::mat4x3 object_to_light;
+			glm::mat3 normal_to_light;
+			make_transforms(drawable, &object_to_clip, &object_to_light, &normal_to_light);
+			if (pipeline.OBJECT_TO_CLIP_mat4 != -1U) {
+				glUniformMatrix4fv(pipeline.OBJECT_TO_CLIP_mat4, 1, GL_FALSE, glm::value_ptr(object_to_clip));
+			}
+			if (pipeline.OBJECT_TO_LIGHT_mat4x3 != -1U) {
+				glUniformMatrix4x3fv(pipeline.OBJECT_TO_LIGHT_mat4x3, 1, GL_FALSE, glm::value_ptr(object_to_light));
+			}
+			if (pipeline.NORMAL_TO_LIGHT_mat3 != -1U) {
+				glUniformMatrix3fv(pipeline.NORMAL_TO_LIGHT_mat3, 1, GL_FALSE, glm::value_ptr(normal_to_light));
 			}
 		}
-		glActiveTexture(GL_TEXTURE0);
 
+		//draw the object:
+		if (pipeline.index_type != GL_NONE) {
+			glDrawRangeElementsBaseVertex(pipeline.type, 0, pipeline.count - 1, GLsizei(index_count), pipeline.index_type, (GLbyte *)0 + index_start, GLint(pipeline.start));
+		} else {
+			glDrawArrays(pipeline.type, pipeline.start, pipeline.count);
+		}
+		draw_stats.drawn += 1;
+	}
+
+	//un-bind textures:
+	for (uint32_t i = 0; i < Drawable::Pipeline::TextureCount; ++i) {
+		bind_texture(i, Drawable::Pipeline::TextureInfo());
+	}
+	for (GLuint unit : { LightsUnit, ClustersUnit, LightIndicesUnit }) {
+		glActiveTexture(GL_TEXTURE0 + unit);
+		glBindTexture(GL_TEXTURE_BUFFER, 0);
 	}
+	glActiveTexture(GL_TEXTURE0);
+	draw_stats.state_changes_saved = (draw_stats.state_changes_saved > draw_stats.state_changes ? draw_stats.state_changes_saved - draw_stats.state_changes : 0);
 
 	glUseProgram(0);
 	glBindVertexArray(0);
@@ -171,8 +911,10 @@ void Scene::load(std::string const &filename,
 
 	std::ifstream file(filename, std::ios::binary);
 
-	std::vector< char > names;
-	read_chunk(file, "str0", &names);
+	//names are kept in one shared table, which transform names refer to:
+	std::shared_ptr< std::vector< char > > names_table = std::make_shared< std::vector< char > >();
+	read_chunk(file, "str0", names_table.get());
+	std::vector< char > const &names = *names_table;
 
 	struct HierarchyEntry {
 		uint32_t parent;
@@ -221,6 +963,8 @@ void Scene::load(std::string const &filename,
 	//--------------------------------
 	//Now that file is loaded, create transforms for hierarchy entries:
 
+	name_tables.emplace_back(names_table);
+
 	std::vector< Transform * > hierarchy_transforms;
 	hierarchy_transforms.reserve(hierarchy.size());
 
@@ -235,7 +979,7 @@ void Scene::load(std::string const &filename,
 		}
 
 		if (h.name_begin <= h.name_end && h.name_end <= names.size()) {
-			t->name = std::string(names.begin() + h.name_begin, names.begin() + h.name_end);
+			t->name = std::string_view(names.data() + h.name_begin, h.name_end - h.name_begin);
 		} else {
 				throw std::runtime_error("scene file '" + filename + "' contains hierarchy entry with invalid name indices");
 		}
@@ -308,8 +1052,8 @@ void Scene::load(std::string const &filename,
 		std::cerr << "WARNING: trailing data in scene file '" << filename << "'" << std::endl;
 	}
 
-
-
+	//index names for find_*():
+	rebuild_index();
 }
 
 //-------------------------
@@ -333,10 +1077,17 @@ void Scene::set(Scene const &other, std::unordered_map< Transform const *, Trans
 	std::unordered_map< Transform const *, Transform * > &transform_to_transform = *(transform_map_ ? transform_map_ : &t2t_temp);
 
 	transform_to_transform.clear();
+	transform_to_transform.reserve(other.transforms.size() + 1);
+
+	//(this is a full copy, not an instance)
+	prototype = nullptr;
 
 	//null transform maps to itself:
 	transform_to_transform.insert(std::make_pair(nullptr, nullptr));
 
+	//Share name tables (transform names refer to these):
+	name_tables = other.name_tables;
+
 	//Copy transforms and store mapping:
 	transforms.clear();
 	for (auto const &t : other.transforms) {
@@ -374,4 +1125,172 @@ void Scene::set(Scene const &other, std::unordered_map< Transform const *, Trans
 	for (auto &l : lights) {
 		l.transform = transform_to_transform.at(l.transform);
 	}
+
+	//copy other's settings:
+	update_threads = other.update_threads;
+	light_cluster_threads = other.light_cluster_threads;
+
+	rebuild_index();
+}
+
+void Scene::instance(Scene const &prototype_) {
+	//if this is a fresh copy (or has changed shape), make a full copy:
+	if (prototype != &prototype_
+	 || transforms.size() != prototype_.transforms.size()
+	 || drawables.size() != prototype_.drawables.size()
+	 || cameras.size() != prototype_.cameras.size()
+	 || lights.size() != prototype_.lights.size()) {
+		set(prototype_);
+		prototype = &prototype_;
+		return;
+	}
+
+	//otherwise, objects correspond one-to-one (in list order), so only copy state:
+	auto t = transforms.begin();
+	for (auto const &pt : prototype_.transforms) {
+		t->position = pt.position;
+		t->rotation = pt.rotation;
+		t->scale = pt.scale;
+		++t;
+	}
+
+	auto d = drawables.begin();
+	for (auto const &pd : prototype_.drawables) {
+		d->min = pd.min;
+		d->max = pd.max;
+		d->pipeline = pd.pipeline;
+		std::copy(std::begin(pd.lods), std::end(pd.lods), std::begin(d->lods));
+		d->lod_count = pd.lod_count;
+		++d;
+	}
+
+	auto c = cameras.begin();
+	for (auto const &pc : prototype_.cameras) {
+		c->fovy = pc.fovy;
+		c->aspect = pc.aspect;
+		c->near = pc.near;
+		++c;
+	}
+
+	auto l = lights.begin();
+	for (auto const &pl : prototype_.lights) {
+		l->type = pl.type;
+		l->energy = pl.energy;
+		l->spot_fov = pl.spot_fov;
+		++l;
+	}
+}
+
+std::string_view Scene::store_name(std::string_view name) {
+	auto table = std::make_shared< std::vector< char > >(name.begin(), name.end());
+	name_tables.emplace_back(table);
+	return std::string_view(table->data(), table->size());
+}
+
+void Scene::set_name(Transform &transform, std::string_view name) {
+	transform.name = store_name(name);
+	invalidate_index();
+}
+
+void Scene::rebuild_index() {
+	//(emplace doesn't replace existing entries, so the first object with a given name wins)
+	transform_index.clear();
+	transform_index.reserve(transforms.size());
+	for (auto &t : transforms) {
+		transform_index.emplace(t.name, &t);
+	}
+	camera_index.clear();
+	for (auto &c : cameras) {
+		camera_index.emplace(c.transform->name, &c);
+	}
+	light_index.clear();
+	for (auto &l : lights) {
+		light_index.emplace(l.transform->name, &l);
+	}
+	index_valid = true;
+}
+
+Scene::Transform *Scene::find_transform(std::string_view name) {
+	if (!index_valid) rebuild_index();
+	auto f = transform_index.find(name);
+	return (f != transform_index.end() ? f->second : nullptr);
+}
+
+Scene::Camera *Scene::find_camera(std::string_view name) {
+	if (!index_valid) rebuild_index();
+	auto f = camera_index.find(name);
+	return (f != camera_index.end() ? f->second : nullptr);
+}
+
+Scene::Light *Scene::find_light(std::string_view name) {
+	if (!index_valid) rebuild_index();
+	auto f = light_index.find(name);
+	return (f != light_index.end() ? f->second : nullptr);
+}
+
+Scene::Transform const *Scene::find_transform(std::string_view name) const {
+	if (index_valid) {
+		auto f = transform_index.find(name);
+		return (f != transform_index.end() ? f->second : nullptr);
+	}
+	for (auto const &t : transforms) {
+		if (t.name == name) return &t;
+	}
+	return nullptr;
+}
+
+Scene::Camera const *Scene::find_camera(std::string_view name) const {
+	if (index_valid) {
+		auto f = camera_index.find(name);
+		return (f != camera_index.end() ? f->second : nullptr);
+	}
+	for (auto const &c : cameras) {
+		if (c.transform->name == name) return &c;
+	}
+	return nullptr;
+}
+
+Scene::Light const *Scene::find_light(std::string_view name) const {
+	if (index_valid) {
+		auto f = light_index.find(name);
+		return (f != light_index.end() ? f->second : nullptr);
+	}
+	for (auto const &l : lights) {
+		if (l.transform->name == name) return &l;
+	}
+	return nullptr;
+}
+
+void Scene::snapshot(Snapshot *snapshot_) const {
+	assert(snapshot_);
+	auto &snapshot = *snapshot_;
+
+	snapshot.positions.clear();
+	snapshot.rotations.clear();
+	snapshot.scales.clear();
+	snapshot.positions.reserve(transforms.size());
+	snapshot.rotations.reserve(transforms.size());
+	snapshot.scales.reserve(transforms.size());
+	for (auto const &t : transforms) {
+		snapshot.positions.emplace_back(t.position);
+		snapshot.rotations.emplace_back(t.rotation);
+		snapshot.scales.emplace_back(t.scale);
+	}
+}
+
+void Scene::restore(Snapshot const &snapshot) {
+	if (snapshot.positions.size() != transforms.size()) {
+		throw std::runtime_error("Snapshot has " + std::to_string(snapshot.positions.size()) + " transforms, but scene has " + std::to_string(transforms.size()) + ".");
+	}
+	assert(snapshot.rotations.size() == transforms.size());
+	assert(snapshot.scales.size() == transforms.size());
+
+	//(cached matrices notice the changed values, so nothing else needs to be done)
+	size_t i = 0;
+	for (auto &t : transforms) {
+		t.position = snapshot.positions[i];
+		t.rotation = snapshot.rotations[i];
+		t.scale = snapshot.scales[i];
+		++i;
+	}
 }
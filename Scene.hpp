@@ -11,21 +11,28 @@
  */
 
 #include "GL.hpp"
+#include "LightClusters.hpp"
 
 #include <glm/glm.hpp>
 #include <glm/gtc/quaternion.hpp>
 
 #include <list>
+#include <limits>
+#include <cassert>
 #include <memory>
 #include <functional>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <unordered_map>
 
+struct MeshBuffer;
+
 struct Scene {
 	struct Transform {
 		//Transform names are useful for debugging and looking up locations in a loaded scene:
-		std::string name;
+		// (set them with Scene::set_name(), which keeps the characters in the scene's name_tables)
+		std::string_view get_name() const { return name; }
 
 		//The core function of a transform is to store a transformation in the world:
 		glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f);
@@ -43,10 +50,45 @@ struct Scene {
 		glm::mat4x3 make_local_to_world() const;
 		glm::mat4x3 make_world_to_local() const;
 
+		//..or cached versions of the same, which are only recomputed when position, rotation, scale, or parent
+		//  (of this transform or any ancestor) have changed since they were last computed:
+		glm::mat4x3 const &get_local_to_world() const;
+		glm::mat4x3 const &get_world_to_local() const;
+
+		//bring cached matrices up to date (parent first) and return the cache generation:
+		// if 'pass' is nonzero and this transform was already checked during that pass, returns without checking
+		// (see Scene::update_transforms())
+		uint64_t update_cache(uint64_t pass = 0) const;
+		//recompute cached matrices if this transform (or its parent, whose cache must already be up to date) changed:
+		// (the non-recursive part of update_cache(); 'parent_generation' is the parent's cache generation, or 0 if there is no parent)
+		void refresh_cache(uint64_t parent_generation, uint64_t pass) const;
+
+		//cached matrices and the values they were computed from:
+		struct Cache {
+			glm::mat4x3 local_to_world = glm::mat4x3(1.0f);
+			glm::mat4x3 world_to_local = glm::mat4x3(1.0f);
+			glm::mat3 normal_to_world = glm::mat3(1.0f); //inverse transpose of local_to_world's upper 3x3 (for transforming normals)
+			glm::vec3 position = glm::vec3(0.0f);
+			glm::quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+			glm::vec3 scale = glm::vec3(1.0f);
+			Transform const *parent = nullptr;
+			uint64_t parent_generation = 0;
+			uint64_t generation = 0; //bumped (to a globally unique value) whenever matrices are recomputed; 0 == never computed
+			uint64_t pass = 0; //last update pass in which the cache was checked
+			uint64_t depth_pass = 0; //last update pass that found this transform in its scene's list (and set depth)
+			uint32_t depth = 0; //number of ancestors (in the same scene's list), as of depth_pass
+		};
+		mutable Cache cache;
+
 		//since hierarchy is tracked through pointers, copy-constructing a transform  is not advised:
 		Transform(Transform const &) = delete;
 		//if we delete some constructors, we need to let the compiler know that the default constructor is still okay:
 		Transform() = default;
+
+	private:
+		//views characters owned by a Scene's name_tables (private so a temporary string can't be assigned to it):
+		friend struct Scene;
+		std::string_view name;
 	};
 
 	struct Drawable {
@@ -54,6 +96,11 @@ struct Scene {
 		Drawable(Transform *transform_) : transform(transform_) { assert(transform); }
 		Transform * transform;
 
+		//bounding box in object space, used to skip drawables outside the view frustum:
+		// (the default -- min > max -- means "unknown", and such drawables are never culled)
+		glm::vec3 min = glm::vec3( std::numeric_limits< float >::infinity());
+		glm::vec3 max = glm::vec3(-std::numeric_limits< float >::infinity());
+
 		//Contains all the data needed to run the OpenGL pipeline:
 		struct Pipeline {
 			GLuint program = 0; //shader program; passed to glUseProgram
@@ -65,12 +112,31 @@ struct Scene {
 			GLuint start = 0; //first vertex to draw; passed to glDrawArrays
 			GLuint count = 0; //number of vertices to draw; passed to glDrawArrays
 
+			//indexed drawing (e.g., of an indexed Mesh) -- if index_type is set, the vao's element array is used instead:
+			// draws index_count indices (vertex numbers relative to 'start', all less than 'count') with glDrawRangeElementsBaseVertex
+			GLenum index_type = GL_NONE; //GL_UNSIGNED_SHORT or GL_UNSIGNED_INT (or GL_NONE to draw with glDrawArrays)
+			GLuint index_start = 0; //byte offset of first index in element array
+			GLuint index_count = 0; //number of indices to draw
+
+			//vertex positions are decoded as position_offset + position_scale * Position before being transformed:
+			// (e.g., for compact MeshBuffer layouts -- copy these from the Mesh; the defaults leave positions alone)
+			glm::vec3 position_offset = glm::vec3(0.0f);
+			glm::vec3 position_scale = glm::vec3(1.0f);
+
 			//uniforms:
+			// programs should get per-drawable transforms from the "Draw" uniform block (see Scene::bind_uniform_blocks()),
+			// but plain uniforms are also supported (set these to their locations):
 			GLuint OBJECT_TO_CLIP_mat4 = -1U; //uniform location for object to clip space matrix
 			GLuint OBJECT_TO_LIGHT_mat4x3 = -1U; //uniform location for object to light space (== world space) matrix
 			GLuint NORMAL_TO_LIGHT_mat3 = -1U; //uniform location for normal to light space (== world space) matrix
 
-			std::function< void() > set_uniforms; //(optional) function to set any other useful uniforms
+			//uniform buffer bound to the "Material" block when drawing (e.g., from Scene::make_material()):
+			GLuint material = 0; //0 == the default material
+
+			//(optional) instanced version of the above -- if both are set, drawables with the same program,
+			// vertex range, textures, and material are drawn together with one instanced draw call:
+			GLuint instanced_program = 0; //program that reads OBJECT_TO_CLIP, OBJECT_TO_LIGHT, NORMAL_TO_LIGHT as attributes
+			GLuint instanced_vao = 0; //vertex array object for instanced_program (e.g., from Scene::make_instanced_vao())
 
 			//texture objects to bind for the first TextureCount textures:
 			enum : uint32_t { TextureCount = 4 };
@@ -79,6 +145,25 @@ struct Scene {
 				GLenum target = GL_TEXTURE_2D;
 			} textures[TextureCount];
 		} pipeline;
+
+		//(optional) levels of detail -- simpler versions of an indexed pipeline's mesh (e.g., from MeshBuffer::lookup(name, lod)),
+		// drawn in place of its index range when the drawable is small on screen:
+		// lods[i] is drawn when the bounding sphere of the drawable's box is less than lods[i].screen_size of the viewport
+		// height across (and not small enough for a later level); levels use the pipeline's vertex range and index type,
+		// and should be listed with decreasing screen_size
+		enum : uint32_t { MaxLODs = 3 };
+		struct LOD {
+			GLuint index_start = 0; //byte offset of first index in element array
+			GLuint index_count = 0; //number of indices to draw
+			float screen_size = 0.0f; //fraction of viewport height below which this level is used
+		} lods[MaxLODs];
+		uint32_t lod_count = 0;
+
+		//copy the vertex range, index range, position quantization, bounds, and levels of detail of mesh 'name'
+		// from 'buffer' (the pipeline's program, vertex array objects, textures, and material are left alone):
+		// each level of detail is used below half the screen size of the one before it
+		// note: will throw if mesh not found.
+		void set_mesh(MeshBuffer const &buffer, std::string const &name);
 	};
 
 	struct Camera {
@@ -114,6 +199,9 @@ struct Scene {
 
 		//Spotlight specific:
 		float spot_fov = glm::radians(45.0f); //spot cone fov (in radians)
+
+		//distance beyond which a point or spot light adds less than 1/256 (lights are cut off there when drawing):
+		float make_range() const;
 	};
 
 	//Scenes, of course, may have many of the above objects:
@@ -122,12 +210,179 @@ struct Scene {
 	std::list< Camera > cameras;
 	std::list< Light > lights;
 
+	//Storage for transform names -- each table is shared (not copied) by copies of the scene:
+	std::vector< std::shared_ptr< std::vector< char > const > > name_tables;
+
+	//copy 'name' into name_tables and return a view of the copy:
+	std::string_view store_name(std::string_view name);
+
+	//name 'transform' (a copy of 'name' is stored, so it needn't outlive this call):
+	void set_name(Transform &transform, std::string_view name);
+
+	//Look up objects by name (cameras and lights by the name of their transform):
+	// returns the first match in list order, or nullptr if there is none
+	// (uses a hashed index, which the non-const versions rebuild on the next lookup after invalidate_index();
+	//  load(), set(), and set_name() call it, but code that adds to or erases from transforms, cameras,
+	//  or lights directly must call invalidate_index() itself -- otherwise lookups can return erased objects)
+	// (the const versions never modify the scene, so they are safe to call from several threads at once;
+	//  while the index is invalid they search the lists instead)
+	Transform *find_transform(std::string_view name);
+	Camera *find_camera(std::string_view name);
+	Light *find_light(std::string_view name);
+	Transform const *find_transform(std::string_view name) const;
+	Camera const *find_camera(std::string_view name) const;
+	Light const *find_light(std::string_view name) const;
+	void invalidate_index() { index_valid = false; }
+	void rebuild_index();
+
+	//the index itself:
+	std::unordered_map< std::string_view, Transform * > transform_index;
+	std::unordered_map< std::string_view, Camera * > camera_index;
+	std::unordered_map< std::string_view, Light * > light_index;
+	bool index_valid = false; //false if the lists may have changed since the index was built
+
+	//Bring the cached world matrices of all transforms up to date in one pass:
+	// (only transforms that -- or whose ancestors -- changed are recomputed; draw() calls this itself)
+	// returns the pass number, which can be passed to Transform::update_cache() to skip re-checking
+	// - with update_threads == 1, transforms are updated in list order (each updating its ancestors first)
+	// - otherwise (0 means one per hardware thread), transforms are grouped by depth and each level is split across
+	//   threads of WorkerPool::shared() (at least UpdateMinPerThread transforms per thread); parents are always
+	//   done a level before their children, and the resulting matrices are identical to the single-threaded pass
+	uint64_t update_transforms() const;
+	uint32_t update_threads = 1;
+	enum : size_t { UpdateMinPerThread = 256 };
+
+	//check that every transform's cached matrices are bit-for-bit what the single-threaded update_cache() would compute
+	// from its current position, rotation, scale, and parent's cache (call after update_transforms()):
+	// (update_transforms() checks every 64th multi-threaded pass in builds without NDEBUG)
+	bool check_transforms() const;
+
+	//transforms grouped by depth, as used by the last multi-threaded update_transforms():
+	// depth d holds update_order[update_level_begin[d]] .. update_order[update_level_begin[d+1]-1]
+	mutable std::vector< Transform const * > update_order;
+	mutable std::vector< uint32_t > update_level_begin;
+	mutable uint32_t threaded_updates = 0; //count of multi-threaded update_transforms() (for spacing out checks)
+
 	//The "draw" function provides a convenient way to pass all the things in a scene to OpenGL:
 	void draw(Camera const &camera) const;
 
 	//..sometimes, you want to draw with a custom projection matrix and/or light space:
+	// (drawables with bounds entirely outside the frustum of world_to_clip are skipped; the rest use their level of detail
+	//  for the size of their bounds on screen)
+	// (the rest are sorted by program, vertex array, textures, and then depth, so drawing order is *not* list order)
 	void draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light = glm::mat4x3(1.0f)) const;
 
+	//counts from the most recent draw() call:
+	struct DrawStats {
+		uint32_t drawn = 0; //drawables sent to OpenGL
+		uint32_t culled = 0; //drawables skipped as outside the view frustum
+		uint32_t state_changes = 0; //program, vertex array, and texture binding calls made
+		uint32_t state_changes_saved = 0; //calls skipped compared to setting (and unsetting) all state for every drawable
+		uint32_t instanced_batches = 0; //instanced draw calls (each drawing two or more drawables)
+		uint32_t simplified = 0; //drawables drawn with one of their lods
+	};
+	mutable DrawStats draw_stats;
+
+	//Programs get most uniforms from blocks (std140 layout), which draw() binds to these binding points:
+	enum UniformBlockBinding : GLuint {
+		FrameBinding = 0, //"Frame" block -- camera and light clusters (FrameUniforms)
+		MaterialBinding = 1, //"Material" block -- data shared by drawables with the same material (MaterialUniforms)
+		DrawBinding = 2, //"Draw" block -- per-drawable transforms (DrawUniforms)
+	};
+
+	//connect any "Frame", "Material", and "Draw" blocks in 'program' to their binding points:
+	// (call once after compiling a program)
+	static void bind_uniform_blocks(GLuint program);
+
+	//contents of the "Frame" block -- as GLSL:
+	//  layout(std140) uniform Frame {
+	//    mat4 WORLD_TO_CLIP;
+	//    uvec4 CLUSTER_COUNTS; //x,y,z: LightClusters::X,Y,Z; w: number of global lights
+	//    vec4 CLUSTER_DEPTH; //x: LightClusters::near, y: LightClusters::depth_scale
+	//  };
+	struct FrameUniforms {
+		glm::mat4 world_to_clip;
+		glm::uvec4 cluster_counts;
+		glm::vec4 cluster_depth;
+	};
+	static_assert(sizeof(FrameUniforms) == 96, "FrameUniforms should match std140 layout.");
+
+	//draw() shades with all of 'lights', passing them to programs through buffer textures on these units:
+	// LIGHTS (samplerBuffer) -- three texels per light: (position, type), (direction, cutoff), (energy, range)
+	//   type is 0: point, 1: hemisphere, 2: spot, 3: directional; cutoff is the cosine of a spot light's half-angle
+	//   global (hemisphere and directional) lights come first, then point and spot lights
+	// CLUSTERS (usamplerBuffer) -- (first, count) in LIGHT_INDICES for each LightClusters cluster
+	// LIGHT_INDICES (usamplerBuffer) -- point/spot light numbers (add CLUSTER_COUNTS.w to get an index in LIGHTS)
+	// (positions and directions are in light space, like OBJECT_TO_LIGHT)
+	enum LightTextureUnit : GLuint {
+		LightsUnit = 4,
+		ClustersUnit = 5,
+		LightIndicesUnit = 6,
+	};
+	static_assert(uint32_t(LightsUnit) >= uint32_t(Drawable::Pipeline::TextureCount), "light textures shouldn't share units with drawable textures.");
+
+	//point any LIGHTS, CLUSTERS, and LIGHT_INDICES samplers in 'program' at the units above:
+	// (call once after compiling a program)
+	static void bind_light_samplers(GLuint program);
+
+	//threads draw() uses to bin point and spot lights into clusters (0 means one per hardware thread):
+	// (binning only splits once there are LightClusters::MinLightsPerThread lights per thread)
+	uint32_t light_cluster_threads = 1;
+
+	//(scratch space for draw() -- point/spot light bounds, their clusters, and the contents of LIGHTS)
+	mutable std::vector< LightClusters::Sphere > light_spheres;
+	mutable LightClusters light_clusters;
+	mutable std::vector< glm::vec4 > light_data;
+
+	//contents of the "Material" block -- as GLSL:
+	//  layout(std140) uniform Material { vec4 TINT; };
+	struct MaterialUniforms {
+		glm::vec4 tint = glm::vec4(1.0f); //multiplies color
+	};
+
+	//make a uniform buffer holding 'material', for use as Pipeline::material:
+	static GLuint make_material(MaterialUniforms const &material);
+
+	//contents of the "Draw" block -- as GLSL:
+	//  layout(std140) uniform Draw { mat4 OBJECT_TO_CLIP; mat4x3 OBJECT_TO_LIGHT; mat3 NORMAL_TO_LIGHT; };
+	// (std140 pads matrix columns to vec4, hence the types here)
+	struct DrawUniforms {
+		glm::mat4 object_to_clip;
+		glm::mat4 object_to_light;
+		glm::mat3x4 normal_to_light;
+	};
+	static_assert(sizeof(DrawUniforms) == 176, "DrawUniforms should match std140 layout.");
+	mutable std::vector< char > draw_uniforms; //(scratch space for draw() -- DrawUniforms, one per aligned slot)
+
+	//per-instance data for instanced drawing, read by instanced programs as (per-instance) attributes:
+	struct InstanceData {
+		glm::mat4 object_to_clip;
+		glm::mat4x3 object_to_light;
+		glm::mat3 normal_to_light;
+	};
+	mutable std::vector< InstanceData > instance_data; //(scratch space for draw())
+
+	//with a vertex array object bound, point any OBJECT_TO_CLIP, OBJECT_TO_LIGHT, and NORMAL_TO_LIGHT attributes of 'program'
+	// at the per-instance data draw() streams for instanced drawing; returns the attribute locations bound:
+	static std::vector< GLuint > bind_instance_attributes(GLuint program);
+
+	//locations of the attributes bind_instance_attributes() binds for 'program' (without touching any GL state):
+	static std::vector< GLuint > instance_attribute_locations(GLuint program);
+
+	//build a vertex array object for an instanced program (e.g., Pipeline::instanced_vao):
+	// 'buffer''s attributes as per MeshBuffer::make_vao_for_program, plus the per-instance attributes above
+	static GLuint make_instanced_vao(MeshBuffer const &buffer, GLuint program);
+
+	//draw() collects visible drawables here and sorts them by 'key' to group state changes:
+	struct DrawPacket {
+		uint64_t key;
+		Drawable const *drawable;
+		uint32_t instances = 1; //(set by draw()) size of the instanced run starting here, or 0 if part of an earlier run
+		uint32_t slot = 0; //(set by draw()) slot in draw_uniforms, if not instanced
+		uint32_t lod = 0; //level of detail to draw -- 0 for the pipeline's own index range, i for drawable->lods[i-1]
+	};
+	mutable std::vector< DrawPacket > render_queue; //(kept between draws to avoid reallocating)
+
 	//add transforms/objects/cameras from a scene file to this scene:
 	// the 'on_drawable' callback gives your code a chance to look up mesh data and make Drawables:
 	// throws on file format errors
@@ -150,4 +405,26 @@ struct Scene {
 	Scene &operator=(Scene const &); //...as scene = scene
 	//... as a set() function that optionally returns the transform->transform mapping:
 	void set(Scene const &, std::unordered_map< Transform const *, Transform * > *transform_map = nullptr);
+
+	//copy a "prototype" scene (e.g., a loaded level) cheaply:
+	// the first call copies everything, as per set(); later calls with the same prototype (e.g., to restart a level)
+	// only copy transform positions/rotations/scales and drawable/camera/light parameters, in place
+	// (no allocation, no pointer fixup, and names are left alone -- so pointers into this scene stay valid;
+	//  settings such as update_threads are left alone too, so each instance can have its own)
+	//note: the prototype must outlive this scene (or the next call to set()); later calls fall back to set() if either
+	//      scene has gained or lost objects, but changes to parents or to drawable/camera/light transforms are not undone
+	void instance(Scene const &prototype);
+	Scene const *prototype = nullptr; //scene this is an instance of (if any)
+
+	//compact copy of the mutable state of the transforms, for quick rewind/rollback:
+	struct Snapshot {
+		std::vector< glm::vec3 > positions;
+		std::vector< glm::quat > rotations;
+		std::vector< glm::vec3 > scales;
+	};
+	//store state in 'snapshot' (reusing its storage):
+	void snapshot(Snapshot *snapshot) const;
+	//set state from 'snapshot':
+	// throws if the number of transforms has changed since the snapshot was taken
+	void restore(Snapshot const &snapshot);
 };
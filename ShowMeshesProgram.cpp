@@ -1,6 +1,7 @@
 #include "ShowMeshesProgram.hpp"
 
 #include "gl_compile_program.hpp"
+#include "Mesh.hpp"
 #include "gl_errors.hpp"
 
 Scene::Drawable::Pipeline show_meshes_program_pipeline;
@@ -10,9 +11,7 @@ Load< ShowMeshesProgram > show_meshes_program(LoadTagEarly, []() -> ShowMeshesPr
 
 	show_meshes_program_pipeline.program = ret->program;
 
-	show_meshes_program_pipeline.OBJECT_TO_CLIP_mat4 = ret->OBJECT_TO_CLIP_mat4;
-	show_meshes_program_pipeline.OBJECT_TO_LIGHT_mat4x3 = ret->OBJECT_TO_LIGHT_mat4x3;
-	show_meshes_program_pipeline.NORMAL_TO_LIGHT_mat3 = ret->NORMAL_TO_LIGHT_mat3;
+	//(transforms come from the "Draw" uniform block, so no uniform locations are needed)
 
 	return ret;
 });
@@ -22,21 +21,25 @@ ShowMeshesProgram::ShowMeshesProgram() {
 	program = gl_compile_program(
 		//vertex shader:
 		"#version 330\n"
-		"uniform mat4 OBJECT_TO_CLIP;\n"
-		"uniform mat4x3 OBJECT_TO_LIGHT;\n"
-		"uniform mat3 NORMAL_TO_LIGHT;\n"
+		"layout(std140) uniform Draw {\n"
+		"	mat4 OBJECT_TO_CLIP;\n"
+		"	mat4x3 OBJECT_TO_LIGHT;\n"
+		"	mat3 NORMAL_TO_LIGHT;\n"
+		"};\n"
 		"in vec4 Position;\n"
 		"in vec3 Normal;\n"
+		"in vec2 NormalOct;\n"
 		"in vec4 Color;\n"
 		"in vec2 TexCoord;\n"
 		"out vec3 position;\n"
 		"out vec3 normal;\n"
 		"out vec4 color;\n"
 		"out vec2 texCoord;\n"
+		+ std::string(MeshBuffer::DecodeNormalGLSL) +
 		"void main() {\n"
 		"	gl_Position = OBJECT_TO_CLIP * Position;\n"
 		"	position = OBJECT_TO_LIGHT * Position;\n"
-		"	normal = NORMAL_TO_LIGHT * Normal;\n"
+		"	normal = NORMAL_TO_LIGHT * decode_normal(Normal, NormalOct);\n"
 		"	color = Color;\n"
 		"	texCoord = TexCoord;\n"
 		"}\n"
@@ -79,11 +82,10 @@ ShowMeshesProgram::ShowMeshesProgram() {
 	Color_vec4 = glGetAttribLocation(program, "Color");
 	TexCoord_vec2 = glGetAttribLocation(program, "TexCoord");
 
-	//look up the locations of uniforms:
-	OBJECT_TO_CLIP_mat4 = glGetUniformLocation(program, "OBJECT_TO_CLIP");
-	OBJECT_TO_LIGHT_mat4x3 = glGetUniformLocation(program, "OBJECT_TO_LIGHT");
-	NORMAL_TO_LIGHT_mat3 = glGetUniformLocation(program, "NORMAL_TO_LIGHT");
+	//connect the Draw block to the binding point Scene::draw() uses:
+	Scene::bind_uniform_blocks(program);
 
+	//look up the locations of uniforms:
 	INSPECT_MODE_int = glGetUniformLocation(program, "INSPECT_MODE");
 }
 
@@ -19,10 +19,8 @@ struct ShowMeshesProgram {
 	GLuint Color_vec4 = -1U;
 	GLuint TexCoord_vec2 = -1U;
 
-	//Uniform (per-invocation variable) locations:
-	GLuint OBJECT_TO_CLIP_mat4 = -1U;
-	GLuint OBJECT_TO_LIGHT_mat4x3 = -1U;
-	GLuint NORMAL_TO_LIGHT_mat3 = -1U;
+	//Uniforms:
+	//Draw block -- OBJECT_TO_CLIP, OBJECT_TO_LIGHT, NORMAL_TO_LIGHT (see Scene::UniformBlockBinding)
 
 	GLuint INSPECT_MODE_int = -1U; //0: basic lighting; 1: position only; 2: normal only; 3: color only; 4: texcoord only
 
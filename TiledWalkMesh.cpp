@@ -0,0 +1,337 @@
+#include "TiledWalkMesh.hpp"
+
+#include <glm/gtx/norm.hpp>
+
+#include <iostream>
+#include <algorithm>
+#include <cstdlib>
+#include <cmath>
+
+//lexicographic order on border edges, so matching edges can be found by binary search:
+static bool border_less(TiledWalkMesh::BorderEdge const &x, TiledWalkMesh::BorderEdge const &y) {
+	for (uint32_t i = 0; i < 3; ++i) {
+		if (x.a[i] != y.a[i]) return x.a[i] < y.a[i];
+	}
+	for (uint32_t i = 0; i < 3; ++i) {
+		if (x.b[i] != y.b[i]) return x.b[i] < y.b[i];
+	}
+	return false;
+}
+
+TiledWalkMesh::TiledWalkMesh(std::string const &filename, std::string const &name, float tile_size_, int32_t radius_)
+	: tile_size(tile_size_), radius(radius_), file(filename) {
+	if (!(tile_size > 0.0f)) throw std::runtime_error("Tile size must be positive.");
+	if (radius < 0) throw std::runtime_error("Tile radius must not be negative.");
+
+	//find tiles (meshes named 'name[x,y]') in the file:
+	for (uint32_t i = 0; i < uint32_t(file.entries.size()); ++i) {
+		std::string const &entry_name = file.entries[i].name;
+		if (entry_name.size() <= name.size() + 1 || entry_name.compare(0, name.size() + 1, name + "[") != 0) continue;
+		char const *at = entry_name.c_str() + name.size() + 1;
+		char *after;
+		long x = std::strtol(at, &after, 10);
+		if (after == at || *after != ',') continue;
+		at = after + 1;
+		long y = std::strtol(at, &after, 10);
+		if (after == at || *after != ']' || after + 1 != entry_name.c_str() + entry_name.size()) continue;
+
+		auto ret = tile_at.emplace(std::make_pair(int32_t(x), int32_t(y)), uint32_t(tiles.size()));
+		if (!ret.second) {
+			throw std::runtime_error("Duplicated tile '" + entry_name + "' in '" + filename + "'");
+		}
+		tiles.emplace_back();
+		tiles.back().coord = glm::ivec2(int32_t(x), int32_t(y));
+		tiles.back().entry = i;
+	}
+	if (tiles.empty()) {
+		throw std::runtime_error("No tiles of walkmesh '" + name + "' in '" + filename + "'");
+	}
+
+	//start background loader:
+	loader = std::thread([this](){
+		std::unique_lock< std::mutex > lock(mutex);
+		while (true) {
+			requested_cv.wait(lock, [this](){ return quit || !requests.empty(); });
+			if (quit) break;
+			uint32_t tile = requests.front();
+			requests.pop_front();
+			working = tile;
+			uint32_t entry = tiles[tile].entry; //(entry is never modified after construction)
+			lock.unlock();
+
+			Tile loaded_tile;
+			std::exception_ptr load_error;
+			try {
+				loaded_tile.mesh.reset(new WalkMesh(file.load(entry)));
+
+				//collect border edges for stitching:
+				WalkMesh const &mesh = *loaded_tile.mesh;
+				for (uint32_t ti = 0; ti < uint32_t(mesh.triangles.size()); ++ti) {
+					for (uint32_t slot = 0; slot < 3; ++slot) {
+						if (mesh.adjacent[ti][slot] != -1U) continue;
+						BorderEdge edge;
+						edge.a = mesh.vertices[mesh.triangles[ti][slot]];
+						edge.b = mesh.vertices[mesh.triangles[ti][(slot + 1) % 3]];
+						edge.edge = (ti << 2) | slot;
+						loaded_tile.border.emplace_back(edge);
+					}
+				}
+				std::sort(loaded_tile.border.begin(), loaded_tile.border.end(), border_less);
+			} catch (...) {
+				load_error = std::current_exception();
+			}
+
+			lock.lock();
+			working = -1U;
+			if (load_error) {
+				if (!error) error = load_error;
+			} else {
+				finished.emplace_back(tile, std::move(loaded_tile));
+			}
+			finished_cv.notify_all();
+		}
+	});
+}
+
+TiledWalkMesh::~TiledWalkMesh() {
+	{
+		std::unique_lock< std::mutex > lock(mutex);
+		quit = true;
+	}
+	requested_cv.notify_all();
+	loader.join();
+}
+
+void TiledWalkMesh::update(std::vector< glm::vec3 > const &positions) {
+	integrate_finished();
+
+	//mark tiles to load (keep == 2) and tiles to keep (keep >= 1):
+	keep.assign(tiles.size(), 0);
+	for (auto const &position : positions) {
+		int32_t x = int32_t(std::floor(position.x / tile_size));
+		int32_t y = int32_t(std::floor(position.y / tile_size));
+		for (int32_t dy = -radius - 1; dy <= radius + 1; ++dy) {
+			for (int32_t dx = -radius - 1; dx <= radius + 1; ++dx) {
+				auto f = tile_at.find(std::make_pair(x + dx, y + dy));
+				if (f == tile_at.end()) continue;
+				uint8_t want = (std::abs(dx) <= radius && std::abs(dy) <= radius ? 2 : 1);
+				keep[f->second] = std::max(keep[f->second], want);
+			}
+		}
+	}
+
+	//unload tiles that are no longer needed:
+	for (uint32_t i = 0; i < uint32_t(loaded.size()); /* later */) {
+		uint32_t tile = loaded[i];
+		if (keep[tile]) {
+			++i;
+			continue;
+		}
+		unstitch(tile);
+		tiles[tile].mesh.reset();
+		tiles[tile].border.clear();
+		tiles[tile].border.shrink_to_fit();
+		tiles[tile].state = Tile::Unloaded;
+		loaded[i] = loaded.back();
+		loaded.pop_back();
+	}
+
+	//request new tiles and cancel requests for tiles that are no longer needed:
+	bool requested = false;
+	{
+		std::unique_lock< std::mutex > lock(mutex);
+		for (uint32_t tile = 0; tile < uint32_t(tiles.size()); ++tile) {
+			if (keep[tile] == 2 && tiles[tile].state == Tile::Unloaded) {
+				tiles[tile].state = Tile::Loading;
+				requests.emplace_back(tile);
+				requested = true;
+			} else if (keep[tile] == 0 && tiles[tile].state == Tile::Loading) {
+				//(if the tile is already being loaded, integrate_finished() will drop it)
+				tiles[tile].state = Tile::Unloaded;
+				auto f = std::find(requests.begin(), requests.end(), tile);
+				if (f != requests.end()) requests.erase(f);
+			}
+		}
+	}
+	if (requested) requested_cv.notify_one();
+}
+
+void TiledWalkMesh::finish_loading() {
+	{
+		std::unique_lock< std::mutex > lock(mutex);
+		finished_cv.wait(lock, [this](){ return (requests.empty() && working == -1U) || error; });
+	}
+	integrate_finished();
+}
+
+void TiledWalkMesh::integrate_finished() {
+	std::vector< std::pair< uint32_t, Tile > > to_integrate;
+	{
+		std::unique_lock< std::mutex > lock(mutex);
+		if (error) {
+			std::exception_ptr e = error;
+			error = nullptr;
+			std::rethrow_exception(e);
+		}
+		to_integrate = std::move(finished);
+		finished.clear();
+	}
+
+	for (auto &tf : to_integrate) {
+		Tile &tile = tiles[tf.first];
+		if (tile.state != Tile::Loading) continue; //was cancelled while loading
+		tile.mesh = std::move(tf.second.mesh);
+		tile.border = std::move(tf.second.border);
+		tile.state = Tile::Loaded;
+		loaded.emplace_back(tf.first);
+		stitch(tf.first);
+	}
+}
+
+void TiledWalkMesh::stitch(uint32_t tile) {
+	Tile &a = tiles[tile];
+	assert(a.state == Tile::Loaded);
+	//n.b. triangles are assigned to tiles by centroid, so (unlike with grid-aligned cuts) a border edge
+	// might be shared with any loaded tile, not just the four direct neighbors; only a few tiles are ever loaded, though.
+	for (uint32_t other : loaded) {
+		if (other == tile) continue;
+		Tile &b = tiles[other];
+		for (auto const &edge : a.border) {
+			BorderEdge reversed;
+			reversed.a = edge.b;
+			reversed.b = edge.a;
+			auto f = std::lower_bound(b.border.begin(), b.border.end(), reversed, border_less);
+			if (f == b.border.end() || f->a != reversed.a || f->b != reversed.b) continue;
+			a.portals[edge.edge] = std::make_pair(other, f->edge);
+			b.portals[f->edge] = std::make_pair(tile, edge.edge);
+		}
+	}
+}
+
+void TiledWalkMesh::unstitch(uint32_t tile) {
+	Tile &a = tiles[tile];
+	for (auto const &portal : a.portals) {
+		tiles[portal.second.first].portals.erase(portal.second.second);
+	}
+	a.portals.clear();
+}
+
+bool TiledWalkMesh::nearest_walk_point(glm::vec3 const &world_point, TiledWalkPoint *closest_) const {
+	assert(closest_);
+	auto &closest = *closest_;
+
+	float closest_dis2 = std::numeric_limits< float >::infinity();
+	closest = TiledWalkPoint();
+	for (uint32_t tile : loaded) {
+		WalkMesh const &mesh = *tiles[tile].mesh;
+		if (mesh.triangles.empty()) continue;
+		WalkPoint wp = mesh.nearest_walk_point(world_point);
+		float dis2 = glm::length2(mesh.to_world_point(wp) - world_point);
+		if (dis2 < closest_dis2) {
+			closest_dis2 = dis2;
+			closest.tile = tile;
+			closest.point = wp;
+		}
+	}
+	return closest.tile != -1U;
+}
+
+bool TiledWalkMesh::cross_edge(TiledWalkPoint const &start, TiledWalkPoint *end_, glm::quat *rotation_) const {
+	assert(end_);
+	auto &end = *end_;
+
+	assert(rotation_);
+	auto &rotation = *rotation_;
+
+	//within the tile, edges are crossed as usual:
+	WalkMesh const &mesh = *tile_mesh(start);
+	end.tile = start.tile;
+	if (mesh.cross_edge(start.point, &end.point, rotation_)) return true;
+
+	//otherwise, check for a portal to another tile:
+	// (WalkMesh::cross_edge filled in end.point.triangle for the boundary edge)
+	uint32_t ti = end.point.triangle;
+	glm::uvec3 const &tri = mesh.triangles[ti];
+	uint32_t slot = (tri.x == start.point.indices.x ? 0 : (tri.y == start.point.indices.x ? 1 : 2));
+
+	auto const &portals = tiles[start.tile].portals;
+	auto f = portals.find((ti << 2) | slot);
+	if (f == portals.end()) return false;
+
+	uint32_t ntile = f->second.first;
+	uint32_t nti = f->second.second >> 2;
+	uint32_t nslot = f->second.second & 3;
+	WalkMesh const &nmesh = *tiles[ntile].mesh;
+	glm::uvec3 const &ntri = nmesh.triangles[nti];
+
+	//same (world) point, on the other tile's triangle (edge reversed):
+	end.tile = ntile;
+	end.point = WalkPoint(
+		glm::uvec3(ntri[nslot], ntri[(nslot + 1) % 3], ntri[(nslot + 2) % 3]),
+		glm::vec3(start.point.weights.y, start.point.weights.x, 0.0f),
+		nti
+	);
+
+	//rotation about the edge that takes the first triangle's normal to the second's:
+	glm::vec3 n1 = mesh.to_world_triangle_normal(start.point);
+	glm::vec3 n2 = nmesh.to_world_triangle_normal(end.point);
+	glm::vec3 axis = mesh.vertices[start.point.indices.y] - mesh.vertices[start.point.indices.x];
+	float len = glm::length(axis);
+	if (len == 0.0f) {
+		rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+	} else {
+		axis /= len;
+		float angle = std::atan2(glm::dot(glm::cross(n1, n2), axis), glm::dot(n1, n2));
+		rotation = glm::angleAxis(angle, axis);
+	}
+
+	return true;
+}
+
+glm::vec3 TiledWalkMesh::walk(TiledWalkPoint *at_, glm::vec3 const &step, uint32_t max_iterations) const {
+	assert(at_);
+	auto &at = *at_;
+
+	glm::vec3 remain = step;
+
+	//same as WalkMesh::walk, but stepping via TiledWalkMesh::cross_edge:
+	for (uint32_t iter = 0; iter < max_iterations; ++iter) {
+		if (remain == glm::vec3(0.0f)) break;
+		WalkMesh const &mesh = *tile_mesh(at);
+		WalkPoint end;
+		float time;
+		mesh.walk_in_triangle(at.point, remain, &end, &time);
+		at.point = end;
+		if (time == 1.0f) {
+			//finished within triangle:
+			remain = glm::vec3(0.0f);
+			break;
+		}
+		//some step remains:
+		remain *= (1.0f - time);
+		//try to step over edge (possibly into another tile):
+		TiledWalkPoint next;
+		glm::quat rotation;
+		if (cross_edge(at, &next, &rotation)) {
+			at = next;
+			//rotate step to follow surface:
+			remain = rotation * remain;
+		} else {
+			//ran into a wall (or an unloaded tile), bounce / slide along it:
+			glm::vec3 const &a = mesh.vertices[at.point.indices.x];
+			glm::vec3 const &b = mesh.vertices[at.point.indices.y];
+			glm::vec3 along = glm::normalize(b-a);
+			glm::vec3 normal = mesh.to_world_triangle_normal(at.point);
+			glm::vec3 in = glm::cross(normal, along);
+
+			float d = glm::dot(remain, in);
+			if (d < 0.0f) {
+				remain += (-1.25f * d) * in;
+			} else {
+				remain += 0.01f * d * in;
+			}
+		}
+	}
+
+	return remain;
+}
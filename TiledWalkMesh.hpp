@@ -0,0 +1,146 @@
+#pragma once
+
+/*
+ * A "TiledWalkMesh" is a walkmesh for a large level, split into square tiles
+ *  (in the xy plane) which are loaded and unloaded in the background based on
+ *  where agents are, so memory use depends on the active neighborhood rather
+ *  than the size of the level.
+ *
+ * Tiles are the meshes named 'name[x,y]' in a walkmesh file, as written by:
+ *  export-walkmeshes.py -- --tile-size=<size> ...
+ * (tile [x,y] holds the triangles whose centroids are in [x,x+1)*size by [y,y+1)*size)
+ *
+ * Edges on tile borders are boundary edges in each tile's WalkMesh; when
+ *  neighboring tiles are both loaded, these are stitched together as "portals"
+ *  so that walking crosses from tile to tile.
+ *
+ * Usage:
+ *  TiledWalkMesh level(data_path("level.w"), "WalkMesh", 20.0f);
+ *  level.update({spawn}); level.finish_loading(); //block for the initial tiles
+ *  level.nearest_walk_point(spawn, &at);
+ *  //every frame:
+ *  level.walk(&at, step);
+ *  level.update({level.to_world_point(at)});
+ *
+ */
+
+#include "WalkMesh.hpp"
+
+#include <map>
+#include <cassert>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <exception>
+#include <condition_variable>
+
+//location on a TiledWalkMesh -- a WalkPoint on one of its tiles:
+struct TiledWalkPoint {
+	uint32_t tile = -1U; //index into TiledWalkMesh::tiles
+	WalkPoint point;
+};
+
+struct TiledWalkMesh {
+	//open the tiles of walkmesh 'name' in a walkmesh file:
+	// - tile_size must match the size used when exporting
+	// - tiles within 'radius' tiles of a position passed to update() are loaded
+	//   (tiles should be larger than the largest triangle so that an agent's triangle is always in its neighborhood)
+	//note: will throw if the file fails to read or has no tiles for 'name'.
+	TiledWalkMesh(std::string const &filename, std::string const &name, float tile_size, int32_t radius = 1);
+	~TiledWalkMesh();
+
+	TiledWalkMesh(TiledWalkMesh const &) = delete;
+	TiledWalkMesh &operator=(TiledWalkMesh const &) = delete;
+
+	//request the tiles around 'positions' (e.g., agent locations) and release the rest:
+	// - tiles within radius of any position are queued for loading in the background
+	// - tiles more than radius + 1 from every position are unloaded (the extra tile avoids thrashing at borders)
+	// - tiles that finished loading since the last call are stitched in
+	//note: will re-throw any exception that happened while loading a tile.
+	void update(std::vector< glm::vec3 > const &positions);
+
+	//block until all tiles requested so far are loaded (and stitch them in):
+	void finish_loading();
+
+	//find the closest point on any loaded tile:
+	// returns false if no tiles are loaded
+	bool nearest_walk_point(glm::vec3 const &world_point, TiledWalkPoint *closest) const;
+
+	//as per WalkMesh::cross_edge, but boundary edges that are portals to loaded tiles are crossed:
+	bool cross_edge(
+		TiledWalkPoint const &start, //[in] walkpoint on triangle edge
+		TiledWalkPoint *end,         //[out] end walkpoint, having crossed edge
+		glm::quat *rotation          //[out] rotation over edge
+	) const;
+
+	//as per WalkMesh::walk, but crosses into neighboring (loaded) tiles:
+	// (tiles that aren't loaded yet act as walls)
+	glm::vec3 walk(
+		TiledWalkPoint *at,          //[in,out] walker location
+		glm::vec3 const &step,       //[in] step to take (in world space)
+		uint32_t max_iterations = 10 //[in] budget of triangle steps
+	) const;
+
+	//used to read back results of walking:
+	glm::vec3 to_world_point(TiledWalkPoint const &wp) const {
+		return tile_mesh(wp)->to_world_point(wp.point);
+	}
+	glm::vec3 to_world_smooth_normal(TiledWalkPoint const &wp) const {
+		return tile_mesh(wp)->to_world_smooth_normal(wp.point);
+	}
+	glm::vec3 to_world_triangle_normal(TiledWalkPoint const &wp) const {
+		return tile_mesh(wp)->to_world_triangle_normal(wp.point);
+	}
+
+	//mesh of the (loaded) tile a walkpoint is on:
+	WalkMesh const *tile_mesh(TiledWalkPoint const &wp) const {
+		assert(wp.tile < tiles.size() && tiles[wp.tile].mesh && "walkpoint should be on a loaded tile");
+		return tiles[wp.tile].mesh.get();
+	}
+
+	//number of tiles currently loaded:
+	size_t loaded_count() const { return loaded.size(); }
+
+	//------ internals ------
+	float tile_size;
+	int32_t radius;
+
+	WalkMeshFile file;
+
+	//edge on the border of a tile, by endpoint positions (border edges of neighboring tiles match with endpoints swapped):
+	struct BorderEdge {
+		glm::vec3 a, b;
+		uint32_t edge; //(triangle << 2 | slot)
+	};
+
+	struct Tile {
+		glm::ivec2 coord = glm::ivec2(0);
+		uint32_t entry = -1U; //in file.entries
+		enum State : uint8_t { Unloaded, Loading, Loaded } state = Unloaded;
+		std::unique_ptr< WalkMesh > mesh; //if Loaded
+		std::vector< BorderEdge > border; //boundary edges of mesh, sorted by (a, b)
+		//stitched border edges: (triangle << 2 | slot) -> (other tile, other triangle << 2 | other slot):
+		std::unordered_map< uint32_t, std::pair< uint32_t, uint32_t > > portals;
+	};
+	std::vector< Tile > tiles;
+	std::map< std::pair< int32_t, int32_t >, uint32_t > tile_at; //tile coordinate -> index in tiles
+	std::vector< uint32_t > loaded; //indices of Loaded tiles
+	std::vector< uint8_t > keep; //scratch space for update()
+
+	//move finished loads into tiles and stitch them (called with mutex *not* held):
+	void integrate_finished();
+	//stitch / unstitch tile's border edges to those of other loaded tiles:
+	void stitch(uint32_t tile);
+	void unstitch(uint32_t tile);
+
+	//background loading -- everything below is protected by 'mutex':
+	std::mutex mutex;
+	std::condition_variable requested_cv; //signalled when requests are added (or quit is set)
+	std::condition_variable finished_cv; //signalled when a load finishes
+	std::deque< uint32_t > requests; //tiles to load, in order
+	uint32_t working = -1U; //tile the loader is working on
+	std::vector< std::pair< uint32_t, Tile > > finished; //loaded tiles (mesh and border filled in), waiting for integrate_finished()
+	std::exception_ptr error; //exception thrown by loader, re-thrown by update()
+	bool quit = false;
+	std::thread loader;
+};
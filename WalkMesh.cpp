@@ -1,31 +1,92 @@
 #include "WalkMesh.hpp"
 
 #include "read_write_chunk.hpp"
+#include "MappedFile.hpp"
+#include "WorkerPool.hpp"
 
 #include <glm/gtx/norm.hpp>
 #include <glm/gtx/string_cast.hpp>
 
 #include <iostream>
-#include <fstream>
+#include <cstring>
 #include <algorithm>
 #include <string>
+#include <thread>
+#include <functional>
 
-WalkMesh::WalkMesh(std::vector< glm::vec3 > const &vertices_, std::vector< glm::vec3 > const &normals_, std::vector< glm::uvec3 > const &triangles_)
-	: vertices(vertices_), normals(normals_), triangles(triangles_) {
+//use SSE for triangle packet tests where available (always the case on x86-64):
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define WALKMESH_SSE 1
+#include <emmintrin.h>
+#else
+#define WALKMESH_SSE 0
+#endif
 
-	//construct next_vertex map (maps each edge to the next vertex in the triangle):
-	next_vertex.reserve(triangles.size()*3);
-	auto do_next = [this](uint32_t a, uint32_t b, uint32_t c) {
-		auto ret = next_vertex.insert(std::make_pair(glm::uvec2(a,b), c));
-		assert(ret.second);
-	};
+WalkMesh::WalkMesh(std::vector< glm::vec3 > vertices_, std::vector< glm::vec3 > normals_, std::vector< glm::uvec3 > triangles_, std::vector< glm::uvec3 > adjacent_)
+	: vertices(std::move(vertices_)), normals(std::move(normals_)), triangles(std::move(triangles_)), adjacent(std::move(adjacent_)) {
+
+	//construct vertex -> triangle lookup (counting sort of triangle corners by vertex):
+	vertex_triangles_begin.assign(vertices.size() + 1, 0);
 	for (auto const &tri : triangles) {
-		do_next(tri.x, tri.y, tri.z);
-		do_next(tri.y, tri.z, tri.x);
-		do_next(tri.z, tri.x, tri.y);
+		vertex_triangles_begin[tri.x + 1] += 1;
+		vertex_triangles_begin[tri.y + 1] += 1;
+		vertex_triangles_begin[tri.z + 1] += 1;
+	}
+	for (uint32_t v = 0; v < uint32_t(vertices.size()); ++v) {
+		vertex_triangles_begin[v + 1] += vertex_triangles_begin[v];
+	}
+	vertex_triangles.resize(triangles.size() * 3);
+	{
+		std::vector< uint32_t > fill(vertex_triangles_begin.begin(), vertex_triangles_begin.end() - 1);
+		for (uint32_t ti = 0; ti < uint32_t(triangles.size()); ++ti) {
+			vertex_triangles[fill[triangles[ti].x]++] = ti;
+			vertex_triangles[fill[triangles[ti].y]++] = ti;
+			vertex_triangles[fill[triangles[ti].z]++] = ti;
+		}
+	}
+
+	assert(triangles.size() < (1U << 30) && "adjacency packs triangle indices into 30 bits");
+	if (!adjacent.empty()) {
+		//adjacency was supplied (e.g., precomputed by the exporter); check that it is consistent:
+		assert(adjacent.size() == triangles.size() && "adjacency should have one entry per triangle");
+		#ifndef NDEBUG
+		for (uint32_t ti = 0; ti < uint32_t(triangles.size()); ++ti) {
+			for (uint32_t slot = 0; slot < 3; ++slot) {
+				uint32_t across = adjacent[ti][slot];
+				if (across == -1U) continue;
+				uint32_t nti = across >> 2;
+				uint32_t nslot = across & 3;
+				assert(nti < triangles.size() && nslot < 3);
+				assert(adjacent[nti][nslot] == ((ti << 2) | slot) && "adjacency should be symmetric");
+				assert(triangles[nti][nslot] == triangles[ti][(slot + 1) % 3] && triangles[nti][(nslot + 1) % 3] == triangles[ti][slot]);
+			}
+		}
+		#endif
+	} else {
+		//construct adjacency by finding, for each edge [a,b], the triangle around b that contains edge [b,a]:
+		adjacent.assign(triangles.size(), glm::uvec3(-1U));
+		for (uint32_t ti = 0; ti < uint32_t(triangles.size()); ++ti) {
+			glm::uvec3 const &tri = triangles[ti];
+			for (uint32_t slot = 0; slot < 3; ++slot) {
+				uint32_t a = tri[slot];
+				uint32_t b = tri[(slot + 1) % 3];
+				for (uint32_t i = vertex_triangles_begin[b]; i < vertex_triangles_begin[b+1]; ++i) {
+					uint32_t nti = vertex_triangles[i];
+					glm::uvec3 const &ntri = triangles[nti];
+					for (uint32_t nslot = 0; nslot < 3; ++nslot) {
+						if (ntri[nslot] == b && ntri[(nslot + 1) % 3] == a) {
+							assert(adjacent[ti][slot] == -1U && "each edge should have at most one neighbor");
+							adjacent[ti][slot] = (nti << 2) | nslot;
+						}
+					}
+				}
+			}
+		}
 	}
 
 	//DEBUG: are vertex normals consistent with geometric normals?
+	// (only checked in debug builds -- the loop is pure overhead at load time otherwise)
+	#ifndef NDEBUG
 	for (auto const &tri : triangles) {
 		glm::vec3 const &a = vertices[tri.x];
 		glm::vec3 const &b = vertices[tri.y];
@@ -38,6 +99,151 @@ WalkMesh::WalkMesh(std::vector< glm::vec3 > const &vertices_, std::vector< glm::
 
 		assert(da > 0.1f && db > 0.1f && dc > 0.1f);
 	}
+	#endif
+
+	//precompute per-triangle normals and world-delta -> barycentric-delta matrices:
+	// the rows of inverse([b-a c-a n]) take a world-space delta to (d_y, d_z, d_normal),
+	// so barycentric deltas are (-d_y-d_z, d_y, d_z) -- any out-of-plane component is dropped
+	triangle_normals.reserve(triangles.size());
+	triangle_to_barycentric.reserve(triangles.size());
+	for (auto const &tri : triangles) {
+		glm::vec3 ab = vertices[tri.y] - vertices[tri.x];
+		glm::vec3 ac = vertices[tri.z] - vertices[tri.x];
+		glm::vec3 cr = glm::cross(ab, ac);
+		float area2 = glm::dot(cr, cr);
+		if (area2 == 0.0f) {
+			//degenerate triangle; steps on it go nowhere:
+			triangle_normals.emplace_back(0.0f, 0.0f, 1.0f);
+			triangle_to_barycentric.emplace_back(0.0f);
+			continue;
+		}
+		glm::vec3 n = cr / std::sqrt(area2);
+		float det = glm::dot(n, cr);
+		glm::vec3 dy = glm::cross(ac, n) / det;
+		glm::vec3 dz = glm::cross(n, ab) / det;
+		triangle_normals.emplace_back(n);
+		//glm matrices are column-major, so build from columns and transpose to get rows:
+		triangle_to_barycentric.emplace_back(glm::transpose(glm::mat3(-dy-dz, dy, dz)));
+	}
+
+	//build bvh over triangles:
+	if (!triangles.empty()) {
+		//triangles per leaf -- small enough that leaf tests are cheap, large enough to keep the tree shallow:
+		constexpr uint32_t LeafSize = 4;
+
+		std::vector< glm::vec3 > centroids;
+		centroids.reserve(triangles.size());
+		for (auto const &tri : triangles) {
+			centroids.emplace_back((vertices[tri.x] + vertices[tri.y] + vertices[tri.z]) / 3.0f);
+		}
+
+		bvh_triangles.reserve(triangles.size());
+		for (uint32_t ti = 0; ti < uint32_t(triangles.size()); ++ti) {
+			bvh_triangles.emplace_back(ti);
+		}
+
+		//a median-split tree over n triangles has fewer than 2n/LeafSize nodes:
+		bvh_nodes.reserve(2 * (triangles.size() / LeafSize + 1));
+		bvh_nodes.emplace_back();
+		bvh_nodes[0].first = 0;
+		bvh_nodes[0].count = uint32_t(triangles.size());
+
+		std::vector< uint32_t > todo;
+		todo.emplace_back(0);
+		while (!todo.empty()) {
+			uint32_t ni = todo.back();
+			todo.pop_back();
+			uint32_t first = bvh_nodes[ni].first;
+			uint32_t count = bvh_nodes[ni].count;
+
+			//compute bounds of triangles and triangle centroids:
+			glm::vec3 min = glm::vec3( std::numeric_limits< float >::infinity());
+			glm::vec3 max = glm::vec3(-std::numeric_limits< float >::infinity());
+			glm::vec3 c_min = min;
+			glm::vec3 c_max = max;
+			for (uint32_t i = first; i < first + count; ++i) {
+				glm::uvec3 const &tri = triangles[bvh_triangles[i]];
+				min = glm::min(min, glm::min(vertices[tri.x], glm::min(vertices[tri.y], vertices[tri.z])));
+				max = glm::max(max, glm::max(vertices[tri.x], glm::max(vertices[tri.y], vertices[tri.z])));
+				c_min = glm::min(c_min, centroids[bvh_triangles[i]]);
+				c_max = glm::max(c_max, centroids[bvh_triangles[i]]);
+			}
+
+			//pad bounds so that rounding in the closest-point computation never lands outside the box:
+			// (otherwise pruning could miss the triangle the linear scan would pick)
+			float pad = 1e-5f * std::max(
+				std::max(std::max(std::abs(min.x), std::abs(min.y)), std::abs(min.z)),
+				std::max(std::max(std::abs(max.x), std::abs(max.y)), std::abs(max.z))
+			) + 1e-20f;
+			bvh_nodes[ni].min = min - glm::vec3(pad);
+			bvh_nodes[ni].max = max + glm::vec3(pad);
+
+			if (count <= LeafSize) continue;
+
+			//split at the median centroid along the longest axis:
+			glm::vec3 extent = c_max - c_min;
+			uint32_t axis = 0;
+			if (extent.y > extent[axis]) axis = 1;
+			if (extent.z > extent[axis]) axis = 2;
+
+			uint32_t half = count / 2;
+			std::nth_element(bvh_triangles.begin() + first, bvh_triangles.begin() + first + half, bvh_triangles.begin() + first + count,
+				[&centroids, axis](uint32_t a, uint32_t b) {
+					if (centroids[a][axis] != centroids[b][axis]) return centroids[a][axis] < centroids[b][axis];
+					return a < b;
+				}
+			);
+
+			uint32_t child = uint32_t(bvh_nodes.size());
+			bvh_nodes.emplace_back();
+			bvh_nodes.back().first = first;
+			bvh_nodes.back().count = half;
+			bvh_nodes.emplace_back();
+			bvh_nodes.back().first = first + half;
+			bvh_nodes.back().count = count - half;
+
+			bvh_nodes[ni].first = child;
+			bvh_nodes[ni].count = 0;
+
+			todo.emplace_back(child);
+			todo.emplace_back(child + 1);
+		}
+
+		//pack leaf triangles for SIMD tests:
+		for (auto &node : bvh_nodes) {
+			if (node.count == 0) continue;
+			assert(node.count <= PacketSize);
+			node.packet = uint32_t(bvh_packets.size());
+			bvh_packets.emplace_back();
+			TrianglePacket &packet = bvh_packets.back();
+			for (uint32_t lane = 0; lane < PacketSize; ++lane) {
+				uint32_t ti = bvh_triangles[node.first + (lane < node.count ? lane : 0)];
+				glm::vec3 const &a = vertices[triangles[ti].x];
+				glm::vec3 ab = vertices[triangles[ti].y] - a;
+				glm::vec3 ac = vertices[triangles[ti].z] - a;
+				glm::vec3 bc = ac - ab;
+				//rows of the step matrix are exactly the barycentric gradients (all zero for degenerate triangles):
+				glm::mat3 rows = glm::transpose(triangle_to_barycentric[ti]);
+				glm::vec3 gy = rows[1];
+				glm::vec3 gz = rows[2];
+				glm::vec3 n = glm::vec3(0.0f);
+				if (gy != glm::vec3(0.0f) || gz != glm::vec3(0.0f)) n = triangle_normals[ti];
+				auto inv = [](glm::vec3 const &e) {
+					float len2 = glm::dot(e, e);
+					return (len2 == 0.0f ? 0.0f : 1.0f / len2);
+				};
+				packet.ax[lane] = a.x; packet.ay[lane] = a.y; packet.az[lane] = a.z;
+				packet.abx[lane] = ab.x; packet.aby[lane] = ab.y; packet.abz[lane] = ab.z;
+				packet.acx[lane] = ac.x; packet.acy[lane] = ac.y; packet.acz[lane] = ac.z;
+				packet.nx[lane] = n.x; packet.ny[lane] = n.y; packet.nz[lane] = n.z;
+				packet.gyx[lane] = gy.x; packet.gyy[lane] = gy.y; packet.gyz[lane] = gy.z;
+				packet.gzx[lane] = gz.x; packet.gzy[lane] = gz.y; packet.gzz[lane] = gz.z;
+				packet.inv_ab2[lane] = inv(ab);
+				packet.inv_bc2[lane] = inv(bc);
+				packet.inv_ca2[lane] = inv(ac);
+			}
+		}
+	}
 }
 
 //project pt to the plane of triangle a,b,c and return the barycentric weights of the projected point:
@@ -61,66 +267,228 @@ glm::vec3 barycentric_weights(glm::vec3 const &a, glm::vec3 const &b, glm::vec3
 	return glm::vec3(x, y, z);
 }
 
+//find the closest point to world_point on triangle tri:
+// returns squared distance to the closest point, and stores the point in *closest
+// (when several candidate points are equally close, picks the first in the order [interior, edge xy, edge yz, edge zx])
+static float closest_on_triangle(std::vector< glm::vec3 > const &vertices, glm::uvec3 const &tri, glm::vec3 const &world_point, WalkPoint *closest_) {
+	assert(closest_);
+	auto &closest = *closest_;
+
+	glm::vec3 const &a = vertices[tri.x];
+	glm::vec3 const &b = vertices[tri.y];
+	glm::vec3 const &c = vertices[tri.z];
+
+	//get barycentric coordinates of closest point in the plane of (a,b,c):
+	glm::vec3 coords = barycentric_weights(a,b,c, world_point);
+
+	//is that point inside the triangle?
+	if (coords.x >= 0.0f && coords.y >= 0.0f && coords.z >= 0.0f) {
+		//yes, point is inside triangle.
+		closest.indices = tri;
+		closest.weights = coords;
+		return glm::length2(world_point - (coords.x * a + coords.y * b + coords.z * c));
+	}
+
+	float closest_dis2 = std::numeric_limits< float >::infinity();
+
+	//check triangle vertices and edges:
+	auto check_edge = [&world_point, &closest, &closest_dis2, &vertices](uint32_t ai, uint32_t bi, uint32_t ci) {
+		glm::vec3 const &a = vertices[ai];
+		glm::vec3 const &b = vertices[bi];
+
+		//find closest point on line segment ab:
+		float along = glm::dot(world_point-a, b-a);
+		float max = glm::dot(b-a, b-a);
+		glm::vec3 pt;
+		glm::vec3 coords;
+		if (along < 0.0f) {
+			pt = a;
+			coords = glm::vec3(1.0f, 0.0f, 0.0f);
+		} else if (along > max) {
+			pt = b;
+			coords = glm::vec3(0.0f, 1.0f, 0.0f);
+		} else {
+			float amt = along / max;
+			pt = glm::mix(a, b, amt);
+			coords = glm::vec3(1.0f - amt, amt, 0.0f);
+		}
+
+		float dis2 = glm::length2(world_point - pt);
+		if (dis2 < closest_dis2) {
+			closest_dis2 = dis2;
+			closest.indices = glm::uvec3(ai, bi, ci);
+			closest.weights = coords;
+		}
+	};
+	check_edge(tri.x, tri.y, tri.z);
+	check_edge(tri.y, tri.z, tri.x);
+	check_edge(tri.z, tri.x, tri.y);
+
+	return closest_dis2;
+}
+
+//Approximate squared distances from pt to each triangle in a packet:
+// - points that project inside a triangle (allowing a small slop) get their squared distance to the triangle's plane;
+// - others get the minimum squared distance to the triangle's three edges.
+//Both cases are at most the exact distance plus rounding error, which stays below PacketTolerance times the
+// magnitude of the coordinates involved; so the result can be used to conservatively filter candidates for
+// closest_on_triangle(). The SSE and scalar versions compute the same expression.
+static constexpr float PacketInsideSlop = 1e-4f;
+static constexpr float PacketTolerance = 1e-4f;
+
+#if WALKMESH_SSE
+static void packet_dis2(WalkMesh::TrianglePacket const &packet, glm::vec3 const &pt, float *dis2) {
+	__m128 const zero = _mm_setzero_ps();
+	__m128 const one = _mm_set1_ps(1.0f);
+	__m128 const slop = _mm_set1_ps(-PacketInsideSlop);
+
+	auto dot3 = [](__m128 x0, __m128 y0, __m128 z0, __m128 x1, __m128 y1, __m128 z1) {
+		return _mm_add_ps(_mm_add_ps(_mm_mul_ps(x0, x1), _mm_mul_ps(y0, y1)), _mm_mul_ps(z0, z1));
+	};
+	//squared distance from p (relative to segment start) to the segment with direction e:
+	auto segment_dis2 = [&](__m128 px, __m128 py, __m128 pz, __m128 ex, __m128 ey, __m128 ez, __m128 inv_len2) {
+		__m128 t = _mm_mul_ps(dot3(px, py, pz, ex, ey, ez), inv_len2);
+		t = _mm_min_ps(_mm_max_ps(t, zero), one);
+		__m128 dx = _mm_sub_ps(px, _mm_mul_ps(t, ex));
+		__m128 dy = _mm_sub_ps(py, _mm_mul_ps(t, ey));
+		__m128 dz = _mm_sub_ps(pz, _mm_mul_ps(t, ez));
+		return dot3(dx, dy, dz, dx, dy, dz);
+	};
+
+	//pt relative to a:
+	__m128 apx = _mm_sub_ps(_mm_set1_ps(pt.x), _mm_loadu_ps(packet.ax));
+	__m128 apy = _mm_sub_ps(_mm_set1_ps(pt.y), _mm_loadu_ps(packet.ay));
+	__m128 apz = _mm_sub_ps(_mm_set1_ps(pt.z), _mm_loadu_ps(packet.az));
+
+	__m128 abx = _mm_loadu_ps(packet.abx), aby = _mm_loadu_ps(packet.aby), abz = _mm_loadu_ps(packet.abz);
+	__m128 acx = _mm_loadu_ps(packet.acx), acy = _mm_loadu_ps(packet.acy), acz = _mm_loadu_ps(packet.acz);
+
+	//barycentric coordinates of projection:
+	__m128 y = dot3(apx, apy, apz, _mm_loadu_ps(packet.gyx), _mm_loadu_ps(packet.gyy), _mm_loadu_ps(packet.gyz));
+	__m128 z = dot3(apx, apy, apz, _mm_loadu_ps(packet.gzx), _mm_loadu_ps(packet.gzy), _mm_loadu_ps(packet.gzz));
+	__m128 x = _mm_sub_ps(_mm_sub_ps(one, y), z);
+	__m128 inside = _mm_and_ps(_mm_cmpge_ps(x, slop), _mm_and_ps(_mm_cmpge_ps(y, slop), _mm_cmpge_ps(z, slop)));
+
+	//distance to plane:
+	__m128 h = dot3(apx, apy, apz, _mm_loadu_ps(packet.nx), _mm_loadu_ps(packet.ny), _mm_loadu_ps(packet.nz));
+	__m128 plane = _mm_mul_ps(h, h);
+
+	//distance to edges:
+	__m128 edge = segment_dis2(apx, apy, apz, abx, aby, abz, _mm_loadu_ps(packet.inv_ab2));
+	edge = _mm_min_ps(edge, segment_dis2(
+		_mm_sub_ps(apx, abx), _mm_sub_ps(apy, aby), _mm_sub_ps(apz, abz),
+		_mm_sub_ps(acx, abx), _mm_sub_ps(acy, aby), _mm_sub_ps(acz, abz),
+		_mm_loadu_ps(packet.inv_bc2)
+	));
+	edge = _mm_min_ps(edge, segment_dis2(apx, apy, apz, acx, acy, acz, _mm_loadu_ps(packet.inv_ca2)));
+
+	_mm_storeu_ps(dis2, _mm_or_ps(_mm_and_ps(inside, plane), _mm_andnot_ps(inside, edge)));
+}
+#else
+static void packet_dis2(WalkMesh::TrianglePacket const &packet, glm::vec3 const &pt, float *dis2) {
+	for (uint32_t lane = 0; lane < WalkMesh::PacketSize; ++lane) {
+		glm::vec3 ap = pt - glm::vec3(packet.ax[lane], packet.ay[lane], packet.az[lane]);
+		glm::vec3 ab = glm::vec3(packet.abx[lane], packet.aby[lane], packet.abz[lane]);
+		glm::vec3 ac = glm::vec3(packet.acx[lane], packet.acy[lane], packet.acz[lane]);
+
+		auto segment_dis2 = [](glm::vec3 const &p, glm::vec3 const &e, float inv_len2) {
+			float t = std::min(std::max(glm::dot(p, e) * inv_len2, 0.0f), 1.0f);
+			glm::vec3 d = p - t * e;
+			return glm::dot(d, d);
+		};
+
+		float y = glm::dot(ap, glm::vec3(packet.gyx[lane], packet.gyy[lane], packet.gyz[lane]));
+		float z = glm::dot(ap, glm::vec3(packet.gzx[lane], packet.gzy[lane], packet.gzz[lane]));
+		float x = 1.0f - y - z;
+		if (x >= -PacketInsideSlop && y >= -PacketInsideSlop && z >= -PacketInsideSlop) {
+			float h = glm::dot(ap, glm::vec3(packet.nx[lane], packet.ny[lane], packet.nz[lane]));
+			dis2[lane] = h * h;
+		} else {
+			dis2[lane] = std::min(std::min(
+				segment_dis2(ap, ab, packet.inv_ab2[lane]),
+				segment_dis2(ap - ab, ac - ab, packet.inv_bc2[lane])),
+				segment_dis2(ap, ac, packet.inv_ca2[lane])
+			);
+		}
+	}
+}
+#endif
+
 WalkPoint WalkMesh::nearest_walk_point(glm::vec3 const &world_point) const {
 	assert(!triangles.empty() && "Cannot start on an empty walkmesh");
+	assert(!bvh_nodes.empty());
 
 	WalkPoint closest;
 	float closest_dis2 = std::numeric_limits< float >::infinity();
+	uint32_t closest_triangle = -1U;
 
-	for (auto const &tri : triangles) {
-		//find closest point on triangle:
+	//squared distance from world_point to a node's bounding box:
+	auto box_dis2 = [&world_point](BVHNode const &node) {
+		glm::vec3 d = glm::max(node.min - world_point, 0.0f) + glm::max(world_point - node.max, 0.0f);
+		return glm::dot(d, d);
+	};
+	//can a node hold something at least as close as the current closest point?
+	// (with a bit of slack for rounding, since ties are resolved by triangle index)
+	auto may_contain_closest = [&closest_dis2](float dis2) {
+		return !(dis2 > closest_dis2 * (1.0f + 1e-5f));
+	};
 
-		glm::vec3 const &a = vertices[tri.x];
-		glm::vec3 const &b = vertices[tri.y];
-		glm::vec3 const &c = vertices[tri.z];
+	//allowed error in packet distances, based on the magnitude of the coordinates involved:
+	float tolerance = PacketTolerance * std::max(
+		std::max(std::max(std::abs(world_point.x), std::abs(world_point.y)), std::abs(world_point.z)),
+		std::max(
+			std::max(std::max(std::abs(bvh_nodes[0].min.x), std::abs(bvh_nodes[0].min.y)), std::abs(bvh_nodes[0].min.z)),
+			std::max(std::max(std::abs(bvh_nodes[0].max.x), std::abs(bvh_nodes[0].max.y)), std::abs(bvh_nodes[0].max.z))
+		)
+	);
 
-		//get barycentric coordinates of closest point in the plane of (a,b,c):
-		glm::vec3 coords = barycentric_weights(a,b,c, world_point);
-
-		//is that point inside the triangle?
-		if (coords.x >= 0.0f && coords.y >= 0.0f && coords.z >= 0.0f) {
-			//yes, point is inside triangle.
-			float dis2 = glm::length2(world_point - to_world_point(WalkPoint(tri, coords)));
-			if (dis2 < closest_dis2) {
-				closest_dis2 = dis2;
-				closest.indices = tri;
-				closest.weights = coords;
+	//depth-first traversal, nearer child first:
+	// (tree is median-split, so depth is at most log2(triangles) + 1)
+	struct Entry {
+		uint32_t node;
+		float dis2;
+	};
+	Entry stack[64];
+	uint32_t stack_size = 0;
+	stack[stack_size++] = Entry{0, box_dis2(bvh_nodes[0])};
+
+	while (stack_size > 0) {
+		Entry entry = stack[--stack_size];
+		if (!may_contain_closest(entry.dis2)) continue;
+
+		BVHNode const &node = bvh_nodes[entry.node];
+		if (node.count != 0) {
+			//leaf: filter triangles with the packet test, then check survivors exactly:
+			float packet_dis[PacketSize];
+			if (node.packet != -1U) {
+				packet_dis2(bvh_packets[node.packet], world_point, packet_dis);
 			}
-		} else {
-			//check triangle vertices and edges:
-			auto check_edge = [&world_point, &closest, &closest_dis2, this](uint32_t ai, uint32_t bi, uint32_t ci) {
-				glm::vec3 const &a = vertices[ai];
-				glm::vec3 const &b = vertices[bi];
-
-				//find closest point on line segment ab:
-				float along = glm::dot(world_point-a, b-a);
-				float max = glm::dot(b-a, b-a);
-				glm::vec3 pt;
-				glm::vec3 coords;
-				if (along < 0.0f) {
-					pt = a;
-					coords = glm::vec3(1.0f, 0.0f, 0.0f);
-				} else if (along > max) {
-					pt = b;
-					coords = glm::vec3(0.0f, 1.0f, 0.0f);
-				} else {
-					float amt = along / max;
-					pt = glm::mix(a, b, amt);
-					coords = glm::vec3(1.0f - amt, amt, 0.0f);
+			for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+				if (node.packet != -1U) {
+					float dis = std::sqrt(packet_dis[i - node.first]);
+					if (dis > std::sqrt(closest_dis2) + tolerance) continue;
 				}
-
-				float dis2 = glm::length2(world_point - pt);
-				if (dis2 < closest_dis2) {
+				uint32_t ti = bvh_triangles[i];
+				WalkPoint pt;
+				float dis2 = closest_on_triangle(vertices, triangles[ti], world_point, &pt);
+				//resolve ties in favor of lower-index triangles, as a linear scan would:
+				if (dis2 < closest_dis2 || (dis2 == closest_dis2 && ti < closest_triangle)) {
 					closest_dis2 = dis2;
-					closest.indices = glm::uvec3(ai, bi, ci);
-					closest.weights = coords;
+					closest_triangle = ti;
+					closest = pt;
+					closest.triangle = ti;
 				}
-			};
-			check_edge(tri.x, tri.y, tri.z);
-			check_edge(tri.y, tri.z, tri.x);
-			check_edge(tri.z, tri.x, tri.y);
+			}
+		} else {
+			Entry a{node.first, box_dis2(bvh_nodes[node.first])};
+			Entry b{node.first + 1, box_dis2(bvh_nodes[node.first + 1])};
+			if (a.dis2 < b.dis2) std::swap(a, b);
+			assert(stack_size + 2 <= sizeof(stack) / sizeof(stack[0]));
+			if (may_contain_closest(a.dis2)) stack[stack_size++] = a;
+			if (may_contain_closest(b.dis2)) stack[stack_size++] = b;
 		}
 	}
+
 	assert(closest.indices.x < vertices.size());
 	assert(closest.indices.y < vertices.size());
 	assert(closest.indices.z < vertices.size());
@@ -135,27 +503,31 @@ void WalkMesh::walk_in_triangle(WalkPoint const &start, glm::vec3 const &step, W
 	assert(time_);
 	auto &time = *time_;
 
-	glm::vec3 const& a = vertices[start.indices.x];
-	glm::vec3 const& b = vertices[start.indices.y];
-	glm::vec3 const& c = vertices[start.indices.z];
-
-	glm::vec3 step_coords;
 	//project 'step' into a barycentric-coordinates direction:
-	//TODO
-	glm::vec3 start_pt = to_world_point(start);
-	glm::vec3 end_pt = start_pt + step;
-	step_coords = barycentric_weights(a, b, c, end_pt) - barycentric_weights(a, b, c, start_pt);
-	
+	uint32_t ti = start.triangle;
+	if (ti == -1U) ti = find_triangle(start.indices);
+	assert(ti < triangles.size() && "walk must start on a triangle of this walkmesh");
+	//one matrix-vector product with the precomputed matrix, with rows rotated to match start.indices:
+	glm::vec3 step_coords;
+	{
+		glm::vec3 d = triangle_to_barycentric[ti] * step;
+		glm::uvec3 const &tri = triangles[ti];
+		if (tri.x == start.indices.x) step_coords = d;
+		else if (tri.y == start.indices.x) step_coords = glm::vec3(d.y, d.z, d.x);
+		else step_coords = glm::vec3(d.z, d.x, d.y);
+	}
+
 	//if no edge is crossed, event will just be taking the whole step:
 	time = 1.0f;
 	end = start;
+	end.triangle = ti;
 
 	//figure out which edge (if any) is crossed first.
 	// set time and end appropriately.
-	//TODO
-	float ta = 1.0f;
-	float tb = 1.0f;
-	float tc = 1.0f;
+	// (edges not approached get an infinite time so they can't be mistaken for a hit below)
+	float ta = std::numeric_limits< float >::infinity();
+	float tb = std::numeric_limits< float >::infinity();
+	float tc = std::numeric_limits< float >::infinity();
 	if (step_coords.x != 0.0f) ta = -start.weights.x / step_coords.x;
 	if (step_coords.y != 0.0f) tb = -start.weights.y / step_coords.y;
 	if (step_coords.z != 0.0f) tc = -start.weights.z / step_coords.z;
@@ -173,11 +545,11 @@ void WalkMesh::walk_in_triangle(WalkPoint const &start, glm::vec3 const &step, W
 	//Remember: our convention is that when a WalkPoint is on an edge,
 	// then wp.weights.z == 0.0f (so will likely need to re-order the indices)	
 	if (time == ta) { // hit bc
-		end.indices = glm::vec3(start.indices.y, start.indices.z, start.indices.x);
+		end.indices = glm::uvec3(start.indices.y, start.indices.z, start.indices.x);
 		end.weights = glm::vec3(end.weights.y, end.weights.z, 0.0f);
 	}
 	else if (time == tb) { // hit ca
-		end.indices = glm::vec3(start.indices.z, start.indices.x, start.indices.y);
+		end.indices = glm::uvec3(start.indices.z, start.indices.x, start.indices.y);
 		end.weights = glm::vec3(end.weights.z, end.weights.x, 0.0f);
 	}
 	else if (time == tc) { // hit ab
@@ -195,29 +567,33 @@ bool WalkMesh::cross_edge(WalkPoint const &start, WalkPoint *end_, glm::quat *ro
 	assert(start.weights.z == 0.0f); //*must* be on an edge.
 	glm::uvec2 edge = glm::uvec2(start.indices);
 
+	//find which edge slot of the starting triangle 'edge' is:
+	uint32_t ti = start.triangle;
+	if (ti == -1U) ti = find_triangle(start.indices);
+	assert(ti < triangles.size() && "start must be on a triangle of this walkmesh");
+	glm::uvec3 const &tri = triangles[ti];
+	uint32_t slot = (tri.x == edge.x ? 0 : (tri.y == edge.x ? 1 : 2));
+	assert(tri[slot] == edge.x && tri[(slot + 1) % 3] == edge.y);
+
 	//check if 'edge' is a non-boundary edge:
-	auto f = next_vertex.find(glm::uvec2(edge.y, edge.x));
-	if (f != next_vertex.end()) { //it is!
+	uint32_t across = adjacent[ti][slot];
+	if (across != -1U) { //it is!
+		uint32_t nti = across >> 2;
+		uint32_t nslot = across & 3;
+		assert(triangles[nti][nslot] == edge.y && triangles[nti][(nslot + 1) % 3] == edge.x);
+
 		//make 'end' represent the same (world) point, but on triangle (edge.y, edge.x, [other point]):
-		//TODO
-		end.indices = glm::vec3(edge.y, edge.x, f->second);
+		end.indices = glm::uvec3(edge.y, edge.x, triangles[nti][(nslot + 2) % 3]);
 		end.weights = glm::vec3(start.weights.y, start.weights.x, 0.0f);
+		end.triangle = nti;
 
 		//make 'rotation' the rotation that takes (start.indices)'s normal to (end.indices)'s normal:
-		//TODO
-		glm::vec3 a = vertices[end.indices.x];
-		glm::vec3 b = vertices[end.indices.y];
-		glm::vec3 c1 = vertices[start.indices.z];
-		glm::vec3 c2 = vertices[end.indices.z];
-
-		glm::vec3 norm1 = glm::normalize(glm::cross(b - a, c1 - a));
-		glm::vec3 norm2 = glm::normalize(glm::cross(a - b, c2 - a));
-
+		// (the angle between the triangles' precomputed normals, about the shared edge)
 		float angle;
-		float cos_angle = glm::dot(norm1, norm2);
+		float cos_angle = glm::dot(triangle_normals[ti], triangle_normals[nti]);
 		if (cos_angle >= 1.0f) angle = 0.0f;
-		else if (cos_angle <= -1.0f) cos_angle = 3.14159265f;
-		else angle = std::acos(glm::dot(norm1, norm2));
+		else if (cos_angle <= -1.0f) angle = 3.14159265f;
+		else angle = std::acos(cos_angle);
 
 		glm::vec3 rot_axis = glm::normalize(vertices[end.indices.x] - vertices[end.indices.y]);
 		rotation = glm::normalize(glm::angleAxis(angle, rot_axis));
@@ -225,83 +601,564 @@ bool WalkMesh::cross_edge(WalkPoint const &start, WalkPoint *end_, glm::quat *ro
 		return true;
 	} else {
 		end = start;
+		end.triangle = ti;
 		rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
 		return false;
 	}
 }
 
 
-WalkMeshes::WalkMeshes(std::string const &filename) {
-	std::ifstream file(filename, std::ios::binary);
+glm::vec3 WalkMesh::walk(WalkPoint *at_, glm::vec3 const &step, uint32_t max_iterations) const {
+	assert(at_);
+	auto &at = *at_;
+
+	glm::vec3 remain = step;
+
+	//using a for() instead of a while() here so that if walkpoint gets stuck in
+	//some awkward case, code will not infinite loop:
+	for (uint32_t iter = 0; iter < max_iterations; ++iter) {
+		if (remain == glm::vec3(0.0f)) break;
+		WalkPoint end;
+		float time;
+		walk_in_triangle(at, remain, &end, &time);
+		at = end;
+		if (time == 1.0f) {
+			//finished within triangle:
+			remain = glm::vec3(0.0f);
+			break;
+		}
+		//some step remains:
+		remain *= (1.0f - time);
+		//try to step over edge:
+		glm::quat rotation;
+		if (cross_edge(at, &end, &rotation)) {
+			//stepped to a new triangle:
+			at = end;
+			//rotate step to follow surface:
+			remain = rotation * remain;
+		} else {
+			//ran into a wall, bounce / slide along it:
+			glm::vec3 const &a = vertices[at.indices.x];
+			glm::vec3 const &b = vertices[at.indices.y];
+			glm::vec3 along = glm::normalize(b-a);
+			glm::vec3 normal = to_world_triangle_normal(at);
+			glm::vec3 in = glm::cross(normal, along);
+
+			//check how much 'remain' is pointing out of the triangle:
+			float d = glm::dot(remain, in);
+			if (d < 0.0f) {
+				//bounce off of the wall:
+				remain += (-1.25f * d) * in;
+			} else {
+				//if it's just pointing along the edge, bend slightly away from wall:
+				remain += 0.01f * d * in;
+			}
+		}
+	}
+
+	return remain;
+}
+
+//run 'range(begin, end)' over [0,count), split into nearly-equal ranges over up to 'threads' threads
+// (0 meaning one per hardware thread) with at least 'min_per_thread' items each; returns the sum of the results:
+// (ranges run on WorkerPool::shared(), whose threads persist between calls, so per-frame batches don't start threads)
+static size_t split_across_threads(size_t count, uint32_t threads, size_t min_per_thread, std::function< size_t(size_t, size_t) > const &range) {
+	if (threads == 0) threads = std::max(1U, std::thread::hardware_concurrency());
+	size_t chunks = std::min< size_t >(threads, count / min_per_thread);
+	if (chunks <= 1) return range(0, count);
+
+	std::vector< size_t > results(chunks, 0);
+	WorkerPool::shared().run(uint32_t(chunks), [&](uint32_t c) {
+		size_t begin = count * c / chunks;
+		size_t end = count * (c + 1) / chunks;
+		results[c] = range(begin, end);
+	});
+
+	size_t total = 0;
+	for (auto r : results) total += r;
+	return total;
+}
+
+size_t WalkMesh::walk_batch(WalkPoint *at, glm::vec3 const *steps, size_t count, glm::vec3 *remaining, uint32_t threads, uint32_t max_iterations) const {
+	assert(at || count == 0);
+	assert(steps || count == 0);
+
+	//walk agents [begin,end), returning number that ran out of budget:
+	return split_across_threads(count, threads, WalkBatchMinPerThread, [=](size_t begin, size_t end) -> size_t {
+		size_t stuck = 0;
+		for (size_t i = begin; i < end; ++i) {
+			glm::vec3 remain = walk(&at[i], steps[i], max_iterations);
+			if (remain != glm::vec3(0.0f)) ++stuck;
+			if (remaining) remaining[i] = remain;
+		}
+		return stuck;
+	});
+}
+
+bool WalkMesh::raycast(glm::vec3 const &origin, glm::vec3 const &dir, float max_t, WalkPoint *hit_, float *t_) const {
+	assert(hit_);
+	auto &hit = *hit_;
+	assert(t_);
+	auto &t = *t_;
+
+	t = std::numeric_limits< float >::infinity();
+	if (bvh_nodes.empty()) return false;
+
+	float closest_t = max_t;
+	uint32_t closest_triangle = -1U;
+	glm::vec2 closest_uv = glm::vec2(0.0f);
+
+	//ray vs. node bounds (slab test), returning entry parameter or infinity on a miss:
+	// (zero direction components get a huge-but-finite inverse so that origins on a slab plane don't produce 0 * inf)
+	glm::vec3 inv_dir;
+	for (uint32_t i = 0; i < 3; ++i) {
+		inv_dir[i] = (dir[i] != 0.0f ? 1.0f / dir[i] : 1e30f);
+	}
+	auto box_t = [&](BVHNode const &node) {
+		glm::vec3 t0 = (node.min - origin) * inv_dir;
+		glm::vec3 t1 = (node.max - origin) * inv_dir;
+		glm::vec3 near = glm::min(t0, t1);
+		glm::vec3 far = glm::max(t0, t1);
+		float enter = std::max(std::max(std::max(near.x, near.y), near.z), 0.0f);
+		float exit = std::min(std::min(std::min(far.x, far.y), far.z), closest_t);
+		if (enter > exit) return std::numeric_limits< float >::infinity();
+		return enter;
+	};
+
+	struct Entry {
+		uint32_t node;
+		float t;
+	};
+	Entry stack[64];
+	uint32_t stack_size = 0;
+	stack[stack_size++] = Entry{0, box_t(bvh_nodes[0])};
+
+	while (stack_size > 0) {
+		Entry entry = stack[--stack_size];
+		if (!(entry.t <= closest_t)) continue;
+
+		BVHNode const &node = bvh_nodes[entry.node];
+		if (node.count != 0) {
+			for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+				uint32_t ti = bvh_triangles[i];
+				glm::uvec3 const &tri = triangles[ti];
+				glm::vec3 const &a = vertices[tri.x];
+				glm::vec3 ab = vertices[tri.y] - a;
+				glm::vec3 ac = vertices[tri.z] - a;
+
+				//Moller-Trumbore (two-sided):
+				glm::vec3 p = glm::cross(dir, ac);
+				float det = glm::dot(ab, p);
+				if (det == 0.0f) continue; //ray parallel to (or triangle degenerate)
+				float inv_det = 1.0f / det;
+				glm::vec3 ao = origin - a;
+				float u = glm::dot(ao, p) * inv_det;
+				if (u < 0.0f || u > 1.0f) continue;
+				glm::vec3 q = glm::cross(ao, ab);
+				float v = glm::dot(dir, q) * inv_det;
+				if (v < 0.0f || u + v > 1.0f) continue;
+				float ht = glm::dot(ac, q) * inv_det;
+				if (ht < 0.0f || ht > closest_t) continue;
+				//resolve ties in favor of lower-index triangles, so results don't depend on tree layout:
+				if (ht < closest_t || (ht == closest_t && ti < closest_triangle)) {
+					closest_t = ht;
+					closest_triangle = ti;
+					closest_uv = glm::vec2(u, v);
+				}
+			}
+		} else {
+			Entry a{node.first, box_t(bvh_nodes[node.first])};
+			Entry b{node.first + 1, box_t(bvh_nodes[node.first + 1])};
+			if (a.t < b.t) std::swap(a, b);
+			assert(stack_size + 2 <= sizeof(stack) / sizeof(stack[0]));
+			if (a.t <= closest_t) stack[stack_size++] = a;
+			if (b.t <= closest_t) stack[stack_size++] = b;
+		}
+	}
 
-	std::vector< glm::vec3 > vertices;
-	read_chunk(file, "p...", &vertices);
+	if (closest_triangle == -1U) return false;
 
-	std::vector< glm::vec3 > normals;
-	read_chunk(file, "n...", &normals);
+	hit = WalkPoint(triangles[closest_triangle], glm::vec3(1.0f - closest_uv.x - closest_uv.y, closest_uv.x, closest_uv.y), closest_triangle);
+	t = closest_t;
+	return true;
+}
+
+size_t WalkMesh::raycast_batch(glm::vec3 const *origins, glm::vec3 const *dirs, float const *max_ts, size_t count, WalkPoint *hits, float *ts, uint32_t threads) const {
+	assert(origins || count == 0);
+	assert(dirs || count == 0);
+	assert(max_ts || count == 0);
+	assert(hits || count == 0);
+	assert(ts || count == 0);
+
+	return split_across_threads(count, threads, RaycastBatchMinPerThread, [=](size_t begin, size_t end) -> size_t {
+		size_t hit_count = 0;
+		for (size_t i = begin; i < end; ++i) {
+			if (raycast(origins[i], dirs[i], max_ts[i], &hits[i], &ts[i])) {
+				++hit_count;
+			} else {
+				hits[i] = WalkPoint();
+			}
+		}
+		return hit_count;
+	});
+}
+
+bool WalkMesh::find_path(WalkPoint const &from, WalkPoint const &to, std::vector< WalkPoint > *path_, PathScratch *scratch_) const {
+	assert(path_);
+	assert(scratch_);
+	auto &path = *path_;
+	path.clear();
 
-	std::vector< glm::uvec3 > triangles;
-	read_chunk(file, "tri0", &triangles);
+	uint32_t from_triangle = (from.triangle != -1U ? from.triangle : find_triangle(from.indices));
+	uint32_t to_triangle = (to.triangle != -1U ? to.triangle : find_triangle(to.indices));
+	assert(from_triangle < triangles.size() && "path start must be on a triangle of this walkmesh");
+	assert(to_triangle < triangles.size() && "path end must be on a triangle of this walkmesh");
 
-	std::vector< char > names;
-	read_chunk(file, "str0", &names);
+	glm::vec3 from_pt = to_world_point(from);
+	glm::vec3 to_pt = to_world_point(to);
+
+	auto &scratch = *scratch_;
+	if (scratch.mesh != this) {
+		//(corridors found on some other walkmesh don't apply here)
+		for (auto &e : scratch.cache) {
+			e = PathScratch::CacheEntry();
+		}
+		scratch.mesh = this;
+	}
+	scratch.uses += 1;
+
+	//look for a cached corridor:
+	PathScratch::CacheEntry *entry = nullptr;
+	for (auto &e : scratch.cache) {
+		if (e.from_triangle == from_triangle && e.to_triangle == to_triangle) {
+			entry = &e;
+			break;
+		}
+	}
+
+	if (!entry) {
+		//--- A* over triangles ---
+		if (scratch.opened.size() != triangles.size() || scratch.search == -1U) {
+			scratch.search = 0;
+			scratch.opened.assign(triangles.size(), 0);
+			scratch.closed.assign(triangles.size(), 0);
+			scratch.cost.resize(triangles.size());
+			scratch.parent.resize(triangles.size());
+			scratch.entry.resize(triangles.size());
+		}
+		scratch.search += 1;
+		uint32_t const search = scratch.search;
+
+		auto &open = scratch.open;
+		open.clear();
+		auto heap_order = [](std::pair< float, uint32_t > const &a, std::pair< float, uint32_t > const &b) {
+			return a.first > b.first;
+		};
+
+		scratch.opened[from_triangle] = search;
+		scratch.cost[from_triangle] = 0.0f;
+		scratch.parent[from_triangle] = -1U;
+		scratch.entry[from_triangle] = from_pt;
+		open.emplace_back(glm::length(to_pt - from_pt), from_triangle);
+
+		//point on edge [p0,p1] where a route from 'at' heading toward the goal would cross:
+		// (point on the edge closest to the line from 'at' to the goal, kept a bit away from the endpoints)
+		auto edge_point = [&to_pt](glm::vec3 const &p0, glm::vec3 const &p1, glm::vec3 const &at) {
+			glm::vec3 d1 = p1 - p0;
+			glm::vec3 d2 = to_pt - at;
+			glm::vec3 r = p0 - at;
+			float a = glm::dot(d1, d1);
+			float b = glm::dot(d1, d2);
+			float e = glm::dot(d2, d2);
+			float denom = a * e - b * b;
+			float t = 0.5f;
+			if (denom > 0.0f) t = (b * glm::dot(d2, r) - glm::dot(d1, r) * e) / denom;
+			t = std::min(std::max(t, 0.1f), 0.9f);
+			return p0 + t * d1;
+		};
+
+		bool found = false;
+		while (!open.empty()) {
+			std::pop_heap(open.begin(), open.end(), heap_order);
+			uint32_t ti = open.back().second;
+			open.pop_back();
+			if (scratch.closed[ti] == search) continue; //stale heap entry
+			scratch.closed[ti] = search;
+			if (ti == to_triangle) {
+				found = true;
+				break;
+			}
+
+			//route cost is measured between the points where the route enters each triangle (see edge_point, above):
+			glm::vec3 const &at = scratch.entry[ti];
+			for (uint32_t slot = 0; slot < 3; ++slot) {
+				uint32_t across = adjacent[ti][slot];
+				if (across == -1U) continue;
+				uint32_t nti = across >> 2;
+				glm::vec3 next = edge_point(vertices[triangles[ti][slot]], vertices[triangles[ti][(slot + 1) % 3]], at);
+				float cost = scratch.cost[ti] + glm::length(next - at);
+				//entry points depend on the route taken, so a cheaper route may re-open an expanded triangle:
+				if (scratch.opened[nti] != search || cost < scratch.cost[nti]) {
+					scratch.opened[nti] = search;
+					scratch.closed[nti] = 0;
+					scratch.cost[nti] = cost;
+					scratch.parent[nti] = ti;
+					scratch.entry[nti] = next;
+					open.emplace_back(cost + glm::length(to_pt - next), nti);
+					std::push_heap(open.begin(), open.end(), heap_order);
+				}
+			}
+		}
+		if (!found) return false;
+
+		//store corridor in least-recently-used cache entry:
+		entry = &scratch.cache[0];
+		for (auto &e : scratch.cache) {
+			if (e.last_used < entry->last_used) entry = &e;
+		}
+		entry->from_triangle = from_triangle;
+		entry->to_triangle = to_triangle;
+		entry->corridor.clear();
+		for (uint32_t ti = to_triangle; ti != -1U; ti = scratch.parent[ti]) {
+			entry->corridor.emplace_back(ti);
+		}
+		std::reverse(entry->corridor.begin(), entry->corridor.end());
+	}
+	entry->last_used = scratch.uses;
+	std::vector< uint32_t > const &corridor = entry->corridor;
+	assert(!corridor.empty() && corridor.front() == from_triangle && corridor.back() == to_triangle);
+
+	//--- funnel over portals ---
+	auto &portals = scratch.portals;
+	portals.clear();
+
+	auto normal = [this](uint32_t ti) {
+		return to_world_triangle_normal(WalkPoint(triangles[ti], glm::vec3(1.0f, 0.0f, 0.0f), ti));
+	};
+
+	portals.emplace_back(PathScratch::Portal{from_pt, from_pt, normal(from_triangle), -1U, -1U, from_triangle});
+	for (uint32_t i = 0; i + 1 < corridor.size(); ++i) {
+		uint32_t ti = corridor[i];
+		uint32_t nti = corridor[i+1];
+		uint32_t slot = 0;
+		while (slot < 3 && (adjacent[ti][slot] == -1U || (adjacent[ti][slot] >> 2) != nti)) ++slot;
+		assert(slot < 3 && "corridor triangles must be adjacent");
+		//triangles are CCW, so walking out of triangle ti over edge [a,b], b is on the left and a on the right:
+		uint32_t a = triangles[ti][slot];
+		uint32_t b = triangles[ti][(slot + 1) % 3];
+		portals.emplace_back(PathScratch::Portal{vertices[b], vertices[a], glm::normalize(normal(ti) + normal(nti)), b, a, nti});
+	}
+	portals.emplace_back(PathScratch::Portal{to_pt, to_pt, normal(to_triangle), -1U, -1U, to_triangle});
+
+	//is c to the left of (counterclockwise from) the ray a->b, as seen from 'up'?
+	auto left_of = [](glm::vec3 const &a, glm::vec3 const &b, glm::vec3 const &c, glm::vec3 const &up) {
+		return glm::dot(glm::cross(b - a, c - a), up);
+	};
+
+	path.emplace_back(from);
+	path.back().triangle = from_triangle;
+	glm::vec3 last = from_pt;
+
+	//add a corner to the path at portal i's left or right vertex:
+	// (funnel restarts can revisit the current apex; those repeats are skipped)
+	auto add_corner = [&](uint32_t i, bool left) {
+		PathScratch::Portal const &portal = portals[i];
+		glm::vec3 const &pt = (left ? portal.left : portal.right);
+		uint32_t v = (left ? portal.left_vertex : portal.right_vertex);
+		if (pt == last || v == -1U) return;
+		glm::uvec3 const &tri = triangles[portal.triangle];
+		glm::uvec3 indices = tri;
+		if (tri.y == v) indices = glm::uvec3(tri.y, tri.z, tri.x);
+		else if (tri.z == v) indices = glm::uvec3(tri.z, tri.x, tri.y);
+		assert(indices.x == v);
+		path.emplace_back(indices, glm::vec3(1.0f, 0.0f, 0.0f), portal.triangle);
+		last = pt;
+	};
+
+	glm::vec3 apex = from_pt, left = from_pt, right = from_pt;
+	uint32_t apex_index = 0, left_index = 0, right_index = 0;
+	for (uint32_t i = 1; i < portals.size(); ++i) {
+		PathScratch::Portal const &portal = portals[i];
+
+		//try to narrow the funnel from the right:
+		if (left_of(apex, right, portal.right, portal.up) >= 0.0f) {
+			if (apex == right || left_of(apex, left, portal.right, portal.up) < 0.0f) {
+				right = portal.right;
+				right_index = i;
+			} else {
+				//right side crossed the left side, so the left vertex is a corner:
+				add_corner(left_index, true);
+				apex = left;
+				apex_index = left_index;
+				right = left = apex;
+				right_index = left_index = apex_index;
+				i = apex_index;
+				continue;
+			}
+		}
+
+		//try to narrow the funnel from the left:
+		if (left_of(apex, left, portal.left, portal.up) <= 0.0f) {
+			if (apex == left || left_of(apex, right, portal.left, portal.up) > 0.0f) {
+				left = portal.left;
+				left_index = i;
+			} else {
+				//left side crossed the right side, so the right vertex is a corner:
+				add_corner(right_index, false);
+				apex = right;
+				apex_index = right_index;
+				right = left = apex;
+				right_index = left_index = apex_index;
+				i = apex_index;
+				continue;
+			}
+		}
+	}
+
+	//path ends at 'to' (replacing the last corner if they coincide):
+	if (path.size() > 1 && last == to_pt) path.pop_back();
+	path.emplace_back(to);
+	path.back().triangle = to_triangle;
+
+	return true;
+}
+
+uint32_t WalkMesh::find_triangle(glm::uvec3 const &indices) const {
+	if (indices.x >= vertices.size()) return -1U;
+	for (uint32_t i = vertex_triangles_begin[indices.x]; i < vertex_triangles_begin[indices.x+1]; ++i) {
+		uint32_t ti = vertex_triangles[i];
+		glm::uvec3 const &tri = triangles[ti];
+		if (tri == indices
+		 || tri == glm::uvec3(indices.y, indices.z, indices.x)
+		 || tri == glm::uvec3(indices.z, indices.x, indices.y)) {
+			return ti;
+		}
+	}
+	return -1U;
+}
+
+
+WalkMeshFile::WalkMeshFile(std::string const &filename_) : filename(filename_) {
+	//map the file and locate chunks in-place (nothing is copied until individual meshes are built):
+	file.reset(new MappedFile(filename));
+	char const *at = file->data;
+	char const *end = file->data + file->size;
+
+	size_t vertex_count = view_chunk< glm::vec3 >(&at, end, "p...", &vertices);
+	size_t normal_count = view_chunk< glm::vec3 >(&at, end, "n...", &normals);
+	size_t triangle_count = view_chunk< glm::uvec3 >(&at, end, "tri0", &triangles);
+
+	char const *names;
+	size_t names_size = view_chunk< char >(&at, end, "str0", &names);
 
 	struct IndexEntry {
 		uint32_t name_begin, name_end;
 		uint32_t vertex_begin, vertex_end;
 		uint32_t triangle_begin, triangle_end;
 	};
+	static_assert(sizeof(IndexEntry) == 24, "IndexEntry is packed");
 
 	std::vector< IndexEntry > index;
-	read_chunk(file, "idxA", &index);
+	{
+		char const *data;
+		index.resize(view_chunk< IndexEntry >(&at, end, "idxA", &data));
+		if (!index.empty()) std::memcpy(index.data(), data, index.size() * sizeof(IndexEntry));
+	}
+
+	//optional precomputed adjacency (one entry per triangle, neighbor indices relative to the mesh's triangle range):
+	if (next_chunk_is(at, end, "adj0")) {
+		size_t adjacent_count = view_chunk< glm::uvec3 >(&at, end, "adj0", &adjacent);
+		if (adjacent_count != triangle_count) {
+			throw std::runtime_error("Mis-matched triangle and adjacency sizes in '" + filename + "'");
+		}
+	}
 
-	if (file.peek() != EOF) {
+	if (at != end) {
 		std::cerr << "WARNING: trailing data in walkmesh file '" << filename << "'" << std::endl;
 	}
 
 	//-----------------
 
-	if (vertices.size() != normals.size()) {
+	if (vertex_count != normal_count) {
 		throw std::runtime_error("Mis-matched position and normal sizes in '" + filename + "'");
 	}
 
+	entries.reserve(index.size());
 	for (auto const &e : index) {
-		if (!(e.name_begin <= e.name_end && e.name_end <= names.size())) {
+		if (!(e.name_begin <= e.name_end && e.name_end <= names_size)) {
 			throw std::runtime_error("Invalid name indices in index of '" + filename + "'");
 		}
-		if (!(e.vertex_begin <= e.vertex_end && e.vertex_end <= vertices.size())) {
+		if (!(e.vertex_begin <= e.vertex_end && e.vertex_end <= vertex_count)) {
 			throw std::runtime_error("Invalid vertex indices in index of '" + filename + "'");
 		}
-		if (!(e.triangle_begin <= e.triangle_end && e.triangle_end <= triangles.size())) {
+		if (!(e.triangle_begin <= e.triangle_end && e.triangle_end <= triangle_count)) {
 			throw std::runtime_error("Invalid triangle indices in index of '" + filename + "'");
 		}
+		entries.emplace_back();
+		entries.back().name = std::string(names + e.name_begin, names + e.name_end);
+		entries.back().vertex_begin = e.vertex_begin;
+		entries.back().vertex_end = e.vertex_end;
+		entries.back().triangle_begin = e.triangle_begin;
+		entries.back().triangle_end = e.triangle_end;
+	}
+}
+
+WalkMeshFile::~WalkMeshFile() {
+}
+
+WalkMesh WalkMeshFile::load(uint32_t entry) const {
+	assert(entry < entries.size());
+	Entry const &e = entries[entry];
+
+	//copy vertices/normals:
+	std::vector< glm::vec3 > wm_vertices(e.vertex_end - e.vertex_begin);
+	std::vector< glm::vec3 > wm_normals(e.vertex_end - e.vertex_begin);
+	if (!wm_vertices.empty()) {
+		std::memcpy(wm_vertices.data(), vertices + size_t(e.vertex_begin) * sizeof(glm::vec3), wm_vertices.size() * sizeof(glm::vec3));
+		std::memcpy(wm_normals.data(), normals + size_t(e.vertex_begin) * sizeof(glm::vec3), wm_normals.size() * sizeof(glm::vec3));
+	}
 
-		//copy vertices/normals:
-		std::vector< glm::vec3 > wm_vertices(vertices.begin() + e.vertex_begin, vertices.begin() + e.vertex_end);
-		std::vector< glm::vec3 > wm_normals(normals.begin() + e.vertex_begin, normals.begin() + e.vertex_end);
+	//copy and remap triangles:
+	uint32_t wm_vertex_count = e.vertex_end - e.vertex_begin;
+	std::vector< glm::uvec3 > wm_triangles(e.triangle_end - e.triangle_begin);
+	if (!wm_triangles.empty()) {
+		std::memcpy(wm_triangles.data(), triangles + size_t(e.triangle_begin) * sizeof(glm::uvec3), wm_triangles.size() * sizeof(glm::uvec3));
+	}
+	for (auto &tri : wm_triangles) {
+		//n.b. unsigned wrap-around means indices below vertex_begin also fail the range check:
+		tri -= glm::uvec3(e.vertex_begin);
+		if (!(tri.x < wm_vertex_count && tri.y < wm_vertex_count && tri.z < wm_vertex_count)) {
+			throw std::runtime_error("Invalid triangle in '" + filename + "'");
+		}
+	}
 
-		//remap triangles:
-		std::vector< glm::uvec3 > wm_triangles; wm_triangles.reserve(e.triangle_end - e.triangle_begin);
-		for (uint32_t ti = e.triangle_begin; ti != e.triangle_end; ++ti) {
-			if (!( (e.vertex_begin <= triangles[ti].x && triangles[ti].x < e.vertex_end)
-			    && (e.vertex_begin <= triangles[ti].y && triangles[ti].y < e.vertex_end)
-			    && (e.vertex_begin <= triangles[ti].z && triangles[ti].z < e.vertex_end) )) {
-				throw std::runtime_error("Invalid triangle in '" + filename + "'");
+	//copy adjacency (if present):
+	std::vector< glm::uvec3 > wm_adjacent;
+	if (adjacent && !wm_triangles.empty()) {
+		wm_adjacent.resize(wm_triangles.size());
+		std::memcpy(wm_adjacent.data(), adjacent + size_t(e.triangle_begin) * sizeof(glm::uvec3), wm_adjacent.size() * sizeof(glm::uvec3));
+		for (auto const &adj : wm_adjacent) {
+			for (uint32_t slot = 0; slot < 3; ++slot) {
+				if (adj[slot] != -1U && !((adj[slot] >> 2) < wm_triangles.size() && (adj[slot] & 3) < 3)) {
+					throw std::runtime_error("Invalid adjacency in '" + filename + "'");
+				}
 			}
-			wm_triangles.emplace_back(
-				triangles[ti].x - e.vertex_begin,
-				triangles[ti].y - e.vertex_begin,
-				triangles[ti].z - e.vertex_begin
-			);
 		}
-		
-		std::string name(names.begin() + e.name_begin, names.begin() + e.name_end);
+	}
 
-		auto ret = meshes.emplace(name, WalkMesh(wm_vertices, wm_normals, wm_triangles));
+	return WalkMesh(std::move(wm_vertices), std::move(wm_normals), std::move(wm_triangles), std::move(wm_adjacent));
+}
+
+
+WalkMeshes::WalkMeshes(std::string const &filename) {
+	WalkMeshFile file(filename);
+
+	for (uint32_t i = 0; i < uint32_t(file.entries.size()); ++i) {
+		std::string const &name = file.entries[i].name;
+		auto ret = meshes.emplace(name, file.load(i));
 		if (!ret.second) {
 			throw std::runtime_error("WalkMesh with duplicated name '" + name + "' in '" + filename + "'");
 		}
-
 	}
 }
 
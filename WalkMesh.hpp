@@ -1,11 +1,14 @@
 #pragma once
 
 #include <glm/glm.hpp>
-#include <glm/gtx/hash.hpp> //allows the use of 'uvec2' as an unordered_map key
+#include <glm/gtc/quaternion.hpp>
 
+#include <array>
 #include <vector>
 #include <string>
 #include <unordered_map>
+#include <limits>
+#include <memory>
 
 //"WalkPoint" represents location on the WalkMesh as barycentric coordinates on a triangle:
 struct WalkPoint {
@@ -14,7 +17,11 @@ struct WalkPoint {
 	//barycentric coordinates for current point:
 	glm::vec3 weights = glm::vec3(std::numeric_limits< float >::quiet_NaN());
 	//NOTE: by convention, if WalkPoint is on an edge, indices/weights will be arranged so that weights.z will be 0.0.
+	//index of current triangle in WalkMesh::triangles (or -1U if not known):
+	// (WalkMesh functions fill this in; it lets cross_edge skip looking up the triangle from its indices)
+	uint32_t triangle = -1U;
 	WalkPoint(glm::uvec3 const &indices_, glm::vec3 const &weights_) : indices(indices_), weights(weights_) { }
+	WalkPoint(glm::uvec3 const &indices_, glm::vec3 const &weights_, uint32_t triangle_) : indices(indices_), weights(weights_), triangle(triangle_) { }
 	WalkPoint() = default;
 };
 
@@ -24,14 +31,57 @@ struct WalkMesh {
 	std::vector< glm::vec3 > normals; //normals for interpolated 'up' direction
 	std::vector< glm::uvec3 > triangles; //CCW-oriented
 
-	//This "next vertex" map includes [a,b]->c, [b,c]->a, and [c,a]->b for each triangle (a,b,c), and is useful for checking what's over an edge from a given point:
-	std::unordered_map< glm::uvec2, uint32_t > next_vertex;
+	//Triangle adjacency: for each triangle (a,b,c), the triangles across edges [a,b], [b,c], and [c,a]:
+	// each entry is (neighbor triangle index << 2 | edge slot in neighbor), or -1U for boundary edges.
+	// (edge slot 0 is [x,y], 1 is [y,z], 2 is [z,x]; so the neighbor's slot holds the same edge reversed)
+	std::vector< glm::uvec3 > adjacent;
 
-	//Construct new WalkMesh and build next_vertex structure:
-	WalkMesh(std::vector< glm::vec3 > const &vertices_, std::vector< glm::vec3 > const &normals_, std::vector< glm::uvec3 > const &triangles_);
+	//Vertex -> triangle lookup (used to find the triangle for WalkPoints that don't know theirs):
+	// triangles touching vertex v are vertex_triangles[vertex_triangles_begin[v] .. vertex_triangles_begin[v+1]-1]
+	std::vector< uint32_t > vertex_triangles_begin;
+	std::vector< uint32_t > vertex_triangles;
+
+	//Per-triangle projection data, stored as parallel arrays indexed like 'triangles':
+	// (built by the constructor, so every WalkMesh has them)
+	std::vector< glm::vec3 > triangle_normals; //unit normal of each triangle
+	std::vector< glm::mat3 > triangle_to_barycentric; //maps world-space steps to barycentric deltas (w.r.t. the triangle's own vertex order)
+
+	//Bounding volume hierarchy over triangles, used to accelerate closest-point queries:
+	struct BVHNode {
+		glm::vec3 min = glm::vec3( std::numeric_limits< float >::infinity());
+		glm::vec3 max = glm::vec3(-std::numeric_limits< float >::infinity());
+		//if count == 0, node is internal and children are bvh_nodes[first] and bvh_nodes[first+1]
+		//otherwise, node is a leaf holding bvh_triangles[first] .. bvh_triangles[first+count-1]
+		uint32_t first = 0;
+		uint32_t count = 0;
+		//for leaves, index of the leaf's TrianglePacket in bvh_packets:
+		uint32_t packet = -1U;
+	};
+	std::vector< BVHNode > bvh_nodes; //bvh_nodes[0] is the root
+	std::vector< uint32_t > bvh_triangles; //indices into 'triangles', grouped by leaf
+
+	//Structure-of-arrays copy of the (up to four) triangles in a bvh leaf, for 4-wide SIMD distance tests:
+	// (lanes past the leaf's triangle count hold copies of the first triangle)
+	enum : uint32_t { PacketSize = 4 };
+	struct TrianglePacket {
+		float ax[PacketSize], ay[PacketSize], az[PacketSize]; //first vertex
+		float abx[PacketSize], aby[PacketSize], abz[PacketSize]; //b - a
+		float acx[PacketSize], acy[PacketSize], acz[PacketSize]; //c - a
+		float nx[PacketSize], ny[PacketSize], nz[PacketSize]; //unit normal (zero for degenerate triangles)
+		float gyx[PacketSize], gyy[PacketSize], gyz[PacketSize]; //gradient of barycentric y w.r.t. world position
+		float gzx[PacketSize], gzy[PacketSize], gzz[PacketSize]; //gradient of barycentric z w.r.t. world position
+		float inv_ab2[PacketSize], inv_bc2[PacketSize], inv_ca2[PacketSize]; //1 / squared edge lengths (zero for zero-length edges)
+	};
+	std::vector< TrianglePacket > bvh_packets;
+
+	//Construct new WalkMesh and build adjacency, projection, and bvh structures:
+	// (pass rvalues to avoid copying the data; if adjacent_ is not empty it is used as-is instead of being rebuilt)
+	WalkMesh(std::vector< glm::vec3 > vertices_, std::vector< glm::vec3 > normals_, std::vector< glm::uvec3 > triangles_, std::vector< glm::uvec3 > adjacent_ = std::vector< glm::uvec3 >());
 
 	//used to initialize walking -- finds the closest point on the walk mesh:
-	// (should only need to call this at the start of a level)
+	// (uses the bvh, so it is cheap enough to call for spawns / respawns / teleports)
+	// returns exactly the same point as a linear scan over all triangles (ties go to the lowest triangle index)
+	// (leaves are first tested with a SIMD packet kernel; it only filters candidates, exact results come from the scalar test)
 	WalkPoint nearest_walk_point(glm::vec3 const &world_point) const;
 
 
@@ -64,6 +114,110 @@ struct WalkMesh {
 		glm::quat *rotation     //[out] rotation over edge
 	) const;
 
+	//walk a full step over the mesh: steps within triangles, crosses edges (rotating the step to follow
+	// the surface), and bounces / slides along boundary edges.
+	//  - *at is updated to the final position
+	//  - returns the part of the step not taken if the iteration budget ran out (usually glm::vec3(0.0f))
+	glm::vec3 walk(
+		WalkPoint *at,              //[in,out] walker location
+		glm::vec3 const &step,      //[in] step to take (in world space)
+		uint32_t max_iterations = 10 //[in] budget of triangle steps (so a walker stuck in some awkward case can't loop forever)
+	) const;
+
+	//walk many agents at once; at[i] takes step steps[i] as per walk(), for i in [0,count):
+	//  - if remaining is not null, remaining[i] gets agent i's untaken step
+	//  - batches are split across up to 'threads' threads (0 means one per hardware thread),
+	//    but only when each thread gets at least WalkBatchMinPerThread agents
+	//  - threads come from WorkerPool::shared() and persist between calls, so walking every agent
+	//    in one batch per frame doesn't start or join threads each frame
+	//  - returns the number of agents that ran out of iteration budget
+	enum : size_t { WalkBatchMinPerThread = 256 };
+	size_t walk_batch(
+		WalkPoint *at,            //[in,out] agent locations
+		glm::vec3 const *steps,   //[in] agent steps (in world space)
+		size_t count,             //[in] number of agents
+		glm::vec3 *remaining = nullptr, //[out, optional] untaken steps
+		uint32_t threads = 1,     //[in] maximum number of threads to use
+		uint32_t max_iterations = 10 //[in] per-agent iteration budget
+	) const;
+
+	//cast a ray (origin + t * dir, for t in [0, max_t]) against the walkmesh triangles (from either side):
+	//  - if the ray hits, *hit gets the first hit point, *t gets its ray parameter, and function returns true
+	//    (so *t is the distance along the ray if dir is normalized)
+	//  - otherwise, *t gets infinity and function returns false
+	//useful for line-of-sight checks and ground probes; uses the bvh, so cost is roughly logarithmic in triangle count
+	bool raycast(
+		glm::vec3 const &origin, //[in] ray origin
+		glm::vec3 const &dir,    //[in] ray direction (need not be normalized)
+		float max_t,             //[in] ignore hits past origin + max_t * dir
+		WalkPoint *hit,          //[out] first hit on walkmesh
+		float *t                 //[out] ray parameter of hit
+	) const;
+
+	//cast many rays at once; ray i is (origins[i], dirs[i], max_ts[i]) and results go in hits[i], ts[i], as per raycast():
+	//  - rays that miss get hits[i] = WalkPoint() and ts[i] = infinity
+	//  - batches are split across up to 'threads' threads (0 means one per hardware thread),
+	//    but only when each thread gets at least RaycastBatchMinPerThread rays (on WorkerPool::shared(), as walk_batch)
+	//  - returns the number of rays that hit
+	enum : size_t { RaycastBatchMinPerThread = 256 };
+	size_t raycast_batch(
+		glm::vec3 const *origins, glm::vec3 const *dirs, float const *max_ts, size_t count, //[in] rays
+		WalkPoint *hits, float *ts, //[out] results
+		uint32_t threads = 1 //[in] maximum number of threads to use
+	) const;
+
+	//scratch space for find_path -- each thread that finds paths should have its own:
+	struct PathScratch {
+		//walkmesh the cached corridors below belong to (the cache is cleared when this changes):
+		WalkMesh const *mesh = nullptr;
+
+		//per-triangle search state, valid only when the stamp matches the current search:
+		uint32_t search = 0;
+		std::vector< uint32_t > opened; //== search if triangle has been reached
+		std::vector< uint32_t > closed; //== search if triangle has been expanded
+		std::vector< float > cost; //cost of best known route to triangle
+		std::vector< uint32_t > parent; //previous triangle on that route
+		std::vector< glm::vec3 > entry; //point where that route enters the triangle (on the shared edge, or path start)
+		std::vector< std::pair< float, uint32_t > > open; //(estimated total cost, triangle) as a min-heap
+
+		//corridor of triangles and the portals (shared edges) between them, for the funnel pass:
+		struct Portal {
+			glm::vec3 left, right; //edge endpoints, as seen walking along the corridor
+			glm::vec3 up; //local up direction used for left/right tests
+			uint32_t left_vertex, right_vertex; //vertex indices (or -1U for path endpoints)
+			uint32_t triangle; //corridor triangle entered through this portal
+		};
+		std::vector< Portal > portals;
+
+		//recently found corridors, keyed by (start triangle, goal triangle), least recently used gets replaced:
+		struct CacheEntry {
+			uint32_t from_triangle = -1U;
+			uint32_t to_triangle = -1U;
+			uint32_t last_used = 0;
+			std::vector< uint32_t > corridor;
+		};
+		std::array< CacheEntry, 8 > cache;
+		uint32_t uses = 0;
+	};
+
+	//find a path over the walkmesh from 'from' to 'to':
+	//  - runs A* over the triangle adjacency graph, then straightens the resulting corridor of triangles
+	//    with the funnel ("string pulling") algorithm
+	//  - *path gets the corners of the path: from, any mesh vertices the path bends around, and to
+	//  - returns false (and clears *path) if 'to' is not reachable from 'from'
+	//  - *scratch keeps search state (so repeated queries don't allocate) and a small cache of recent corridors;
+	//    the walkmesh itself isn't modified, so several threads may find paths at once if each passes its own scratch
+	bool find_path(
+		WalkPoint const &from,         //[in] start of path
+		WalkPoint const &to,           //[in] end of path
+		std::vector< WalkPoint > *path, //[out] path corners
+		PathScratch *scratch           //[in,out] search state and corridor cache
+	) const;
+
+	//find the index in 'triangles' of the triangle with (some rotation of) the given indices:
+	// returns -1U if no such triangle exists
+	uint32_t find_triangle(glm::uvec3 const &indices) const;
+
 	//used to read back results of walking:
 	glm::vec3 to_world_point(WalkPoint const &wp) const {
 		//if you were looking here for the lesson solution, well, here you go:
@@ -84,6 +238,7 @@ struct WalkMesh {
 
 	//read back a triangle normal at a walkpoint:
 	glm::vec3 to_world_triangle_normal(WalkPoint const &wp) const {
+		if (wp.triangle != -1U) return triangle_normals[wp.triangle];
 		glm::vec3 const &a = vertices[wp.indices.x];
 		glm::vec3 const &b = vertices[wp.indices.y];
 		glm::vec3 const &c = vertices[wp.indices.z];
@@ -92,8 +247,42 @@ struct WalkMesh {
 
 };
 
+struct MappedFile;
+
+//"WalkMeshFile" is a walkmesh file (as written by export-walkmeshes.py, and compiled by asset-compiler), memory-mapped, with its index parsed:
+// individual meshes are only built (copied out of the mapping) when requested, so this can be used to
+// pull a few meshes out of a large file (see TiledWalkMesh) as well as to load all of them (see WalkMeshes).
+struct WalkMeshFile {
+	//map a file and parse its index:
+	// note: will throw if file fails to read or the index is inconsistent.
+	WalkMeshFile(std::string const &filename);
+	~WalkMeshFile();
+
+	//index of meshes in the file, in file order:
+	struct Entry {
+		std::string name;
+		uint32_t vertex_begin, vertex_end;
+		uint32_t triangle_begin, triangle_end;
+	};
+	std::vector< Entry > entries;
+
+	//build the WalkMesh for entries[entry]:
+	// (only reads the file mapping, so it is safe to call from several threads at once)
+	WalkMesh load(uint32_t entry) const;
+
+	//internals:
+	std::string filename;
+	std::unique_ptr< MappedFile > file;
+	char const *vertices = nullptr; //(chunk data pointers into the mapping; only byte-aligned)
+	char const *normals = nullptr;
+	char const *triangles = nullptr;
+	char const *adjacent = nullptr; //nullptr if the file doesn't have an 'adj0' chunk (asset-compiler adds one)
+};
+
 struct WalkMeshes {
 	//load a list of named WalkMeshes from a file:
+	// (via WalkMeshFile: each mesh's data is copied straight out of the mapped file, and
+	//  if the file has an 'adj0' chunk, triangle adjacency is read from it rather than rebuilt)
 	WalkMeshes(std::string const &filename);
 
 	//retrieve a WalkMesh by name:
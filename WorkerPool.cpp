@@ -0,0 +1,93 @@
+#include "WorkerPool.hpp"
+
+#include <algorithm>
+
+//set while a thread runs a pool job (so a run() from inside a job doesn't wait on the pool it is part of):
+static thread_local bool in_job = false;
+
+WorkerPool::WorkerPool(uint32_t workers) {
+	threads.reserve(workers);
+	for (uint32_t w = 0; w < workers; ++w) {
+		threads.emplace_back([this]() {
+			std::unique_lock< std::mutex > lock(mutex);
+			uint64_t seen = generation;
+			while (true) {
+				wake.wait(lock, [&]() { return quit || generation != seen; });
+				if (quit) break;
+				seen = generation;
+				work(lock);
+			}
+		});
+	}
+}
+
+WorkerPool::~WorkerPool() {
+	{
+		std::lock_guard< std::mutex > lock(mutex);
+		quit = true;
+	}
+	wake.notify_all();
+	for (auto &thread : threads) {
+		thread.join();
+	}
+}
+
+void WorkerPool::work(std::unique_lock< std::mutex > &lock) {
+	++busy;
+	//(a worker that wakes after its run is over finds job == nullptr and goes back to sleep)
+	while (job && next < count) {
+		uint32_t i = next++;
+		std::function< void(uint32_t) > const &current = *job;
+		lock.unlock();
+
+		std::exception_ptr thrown;
+		bool was_in_job = in_job;
+		in_job = true;
+		try {
+			current(i);
+		} catch (...) {
+			thrown = std::current_exception();
+		}
+		in_job = was_in_job;
+
+		lock.lock();
+		if (thrown && !error) error = thrown;
+	}
+	--busy;
+	if (busy == 0) idle.notify_all();
+}
+
+void WorkerPool::run(uint32_t count_, std::function< void(uint32_t) > const &job_) {
+	//nothing to share (or already inside a job) -- just run everything here:
+	if (count_ <= 1 || threads.empty() || in_job) {
+		for (uint32_t i = 0; i < count_; ++i) {
+			job_(i);
+		}
+		return;
+	}
+
+	std::lock_guard< std::mutex > run_lock(run_mutex);
+	std::unique_lock< std::mutex > lock(mutex);
+	job = &job_;
+	count = count_;
+	next = 0;
+	error = nullptr;
+	++generation;
+	wake.notify_all();
+
+	work(lock);
+	idle.wait(lock, [this]() { return busy == 0; });
+
+	job = nullptr;
+	count = 0;
+	std::exception_ptr thrown = error;
+	error = nullptr;
+	lock.unlock();
+
+	if (thrown) std::rethrow_exception(thrown);
+}
+
+WorkerPool &WorkerPool::shared() {
+	static WorkerPool pool(std::max(1U, std::thread::hardware_concurrency()) - 1);
+	return pool;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+/*
+ * A "WorkerPool" is a set of threads that stay around between jobs, so work that is
+ *  split up every frame (e.g., walking thousands of agents) doesn't pay to start and
+ *  join threads every frame.
+ *
+ * WorkerPool::shared().run(chunks, [&](uint32_t chunk) {
+ *     //...do part 'chunk' of the work...
+ * });
+ *
+ */
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct WorkerPool {
+	//start 'workers' threads (these help the thread that calls run(), so 0 is fine and runs everything there):
+	WorkerPool(uint32_t workers);
+	~WorkerPool();
+
+	WorkerPool(WorkerPool const &) = delete;
+	WorkerPool &operator=(WorkerPool const &) = delete;
+
+	//call 'job(i)' for every i in [0,count), on the calling thread and any idle workers; returns once all calls are done:
+	// - chunks are handed out as threads become free, so count may be more (or less) than the number of workers
+	// - one run() happens at a time; run() called from inside a job just runs its jobs in order on that thread
+	// - if a job throws, the first exception is rethrown here (after the other jobs are done)
+	void run(uint32_t count, std::function< void(uint32_t) > const &job);
+
+	//pool with one worker per hardware thread (besides the caller's), started on first use:
+	static WorkerPool &shared();
+
+	//internals:
+	std::vector< std::thread > threads;
+	std::mutex run_mutex; //held for the whole of run(), so runs don't overlap
+	std::mutex mutex; //guards everything below
+	std::condition_variable wake; //signals workers when a run starts (or on shutdown)
+	std::condition_variable idle; //signals run() when a worker stops working on it
+	std::function< void(uint32_t) > const *job = nullptr; //current run's job (nullptr between runs)
+	uint32_t count = 0; //current run's job count
+	uint32_t next = 0; //next job index to hand out
+	uint32_t busy = 0; //threads (including the caller) currently taking part in a run
+	uint64_t generation = 0; //incremented each run, so workers can tell a new run from one they already did
+	bool quit = false;
+	std::exception_ptr error; //first exception thrown by the current run's jobs
+	void work(std::unique_lock< std::mutex > &lock); //take and run jobs until none are left ('lock' holds 'mutex' before and after)
+};
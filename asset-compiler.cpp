@@ -0,0 +1,522 @@
+//Offline asset compiler: turns the files written by the blender exporters into runtime-ready files.
+//Usage:
+// asset-compiler <in.pnct|in.w> [out] [--threads=N] [--cache-size=N] [--lods=N]
+//Mesh files (.pnct, as written by scenes/export-meshes.py):
+// Each mesh is welded into an indexed mesh (if it isn't one already) and simplified into up to --lods (default 3)
+// levels of detail, each with half the triangles of the one before. The triangles of every level are reordered for
+// post-transform vertex cache reuse and then (by cluster) to reduce overdraw, and vertices are renumbered
+// in order of first use. The result (with elr0/ele0 index chunks, a lod0 chunk listing the levels of detail, and
+// a bnd0 chunk with the bounds of each mesh) is written to out.pnct, or back over in.pnct.
+// Prints vertex cache statistics (ACMR and ATVR; lower is better) for each mesh before and after.
+//Walkmesh files (.w, as written by scenes/export-walkmeshes.py):
+// Triangles are checked against their mesh's vertex range, and triangle adjacency is built and written as an adj0 chunk.
+//Meshes are compiled in parallel over --threads (default 0: one per hardware thread); the output doesn't depend on it.
+//String chunks are padded to a multiple of four bytes, so the data of every chunk in the output is 4-byte aligned.
+
+#include "optimize_mesh.hpp"
+#include "read_write_chunk.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+//same layout as the 'pnct' chunk (see Mesh.cpp):
+struct Vertex {
+	glm::vec3 Position;
+	glm::vec3 Normal;
+	glm::u8vec4 Color;
+	glm::vec2 TexCoord;
+};
+static_assert(sizeof(Vertex) == 3*4+3*4+4*1+2*4, "Vertex is packed.");
+
+struct IndexEntry {
+	uint32_t name_begin, name_end;
+	uint32_t vertex_begin, vertex_end;
+};
+static_assert(sizeof(IndexEntry) == 16, "Index entry should be packed");
+
+struct ElementRange {
+	uint32_t element_begin, element_end;
+};
+static_assert(sizeof(ElementRange) == 8, "Element range should be packed");
+
+struct LODEntry {
+	uint32_t index_entry;
+	uint32_t element_begin, element_end;
+};
+static_assert(sizeof(LODEntry) == 12, "LOD entry should be packed");
+
+struct BoundsEntry {
+	glm::vec3 min, max;
+};
+static_assert(sizeof(BoundsEntry) == 24, "Bounds entry should be packed");
+
+//same layout as the 'idxA' chunk (see WalkMesh.cpp):
+struct WalkIndexEntry {
+	uint32_t name_begin, name_end;
+	uint32_t vertex_begin, vertex_end;
+	uint32_t triangle_begin, triangle_end;
+};
+static_assert(sizeof(WalkIndexEntry) == 24, "WalkIndexEntry is packed");
+
+struct Options {
+	uint32_t threads = 0;
+	uint32_t cache_size = VertexCacheSize;
+	uint32_t lods = 3;
+};
+
+//run 'job(i)' for each i in [0,count) over up to 'threads' threads (0 meaning one per hardware thread):
+// (meshes vary a lot in size, so threads take the next job as they finish rather than fixed ranges)
+// if any job throws, remaining jobs are skipped and the first exception is rethrown here
+static void parallel_for(uint32_t count, uint32_t threads, std::function< void(uint32_t) > const &job) {
+	if (threads == 0) threads = std::max(1U, std::thread::hardware_concurrency());
+	threads = std::max(1U, std::min(threads, count));
+
+	std::atomic< uint32_t > next(0);
+	std::mutex error_mutex;
+	std::exception_ptr error;
+	auto work = [&]() {
+		while (true) {
+			uint32_t i = next++;
+			if (i >= count) break;
+			try {
+				job(i);
+			} catch (...) {
+				std::lock_guard< std::mutex > lock(error_mutex);
+				if (!error) error = std::current_exception();
+				next = count;
+			}
+		}
+	};
+
+	std::vector< std::thread > helpers;
+	for (uint32_t t = 1; t < threads; ++t) {
+		helpers.emplace_back(work);
+	}
+	work();
+	for (auto &helper : helpers) {
+		helper.join();
+	}
+	if (error) std::rethrow_exception(error);
+}
+
+//pad string data to a multiple of four bytes (names are referred to by range, so the padding is never read):
+static std::vector< char > padded(std::vector< char > strings) {
+	strings.resize((strings.size() + 3) / 4 * 4, '\0');
+	return strings;
+}
+
+static void print_stats(std::ostream &out, std::string const &label, VertexCacheStats const &stats) {
+	out << "  " << label << " ACMR " << std::fixed << std::setprecision(3) << stats.acmr
+	    << ", ATVR " << stats.atvr
+	    << " (" << stats.transformed << " vertices transformed)\n";
+}
+
+//------ meshes ------
+
+static void compile_meshes(std::string const &in_file, std::string const &out_file, Options const &options) {
+	//------ read ------
+	std::vector< Vertex > vertices;
+	std::vector< char > strings;
+	std::vector< IndexEntry > index;
+	std::vector< ElementRange > element_ranges;
+	std::vector< uint32_t > elements;
+	{
+		std::ifstream file(in_file, std::ios::binary);
+		if (!file) throw std::runtime_error("Failed to open '" + in_file + "'.");
+		read_chunk(file, "pnct", &vertices);
+		read_chunk(file, "str0", &strings);
+		read_chunk(file, "idx0", &index);
+		if (file.peek() != EOF) {
+			read_chunk(file, "elr0", &element_ranges);
+			read_chunk(file, "ele0", &elements);
+			if (element_ranges.size() != index.size()) {
+				throw std::runtime_error("element range count doesn't match index entry count");
+			}
+			//(levels of detail and bounds from an earlier run are made again from scratch)
+			if (file.peek() != EOF) {
+				std::vector< LODEntry > old_lods;
+				read_chunk(file, "lod0", &old_lods);
+			}
+			if (file.peek() != EOF) {
+				std::vector< BoundsEntry > old_bounds;
+				read_chunk(file, "bnd0", &old_bounds);
+			}
+		}
+	}
+
+	//------ optimize each mesh (in parallel) ------
+	struct Compiled {
+		std::vector< Vertex > vertices; //used vertices, in order of first use
+		std::vector< std::vector< uint32_t > > levels; //indices of each level of detail (level 0 is the mesh itself)
+		BoundsEntry bounds;
+		VertexCacheStats before, after;
+		uint32_t vertices_before = 0;
+		std::string log; //(printed in mesh order once all meshes are done)
+	};
+	std::vector< Compiled > compiled(index.size());
+
+	parallel_for(uint32_t(index.size()), options.threads, [&](uint32_t i) {
+		IndexEntry const &entry = index[i];
+		Compiled &out = compiled[i];
+		if (!(entry.name_begin <= entry.name_end && entry.name_end <= strings.size())) {
+			throw std::runtime_error("index entry has out-of-range name begin/end");
+		}
+		if (!(entry.vertex_begin <= entry.vertex_end && entry.vertex_end <= vertices.size())) {
+			throw std::runtime_error("index entry has out-of-range vertex start/count");
+		}
+		std::string name(strings.data() + entry.name_begin, strings.data() + entry.name_end);
+
+		std::vector< Vertex > mesh_vertices(vertices.begin() + entry.vertex_begin, vertices.begin() + entry.vertex_end);
+		std::vector< uint32_t > mesh_indices;
+		if (!element_ranges.empty()) {
+			ElementRange const &range = element_ranges[i];
+			if (!(range.element_begin <= range.element_end && range.element_end <= elements.size())) {
+				throw std::runtime_error("element range has out-of-range begin/end");
+			}
+			mesh_indices.assign(elements.begin() + range.element_begin, elements.begin() + range.element_end);
+			for (uint32_t e : mesh_indices) {
+				if (e >= mesh_vertices.size()) throw std::runtime_error("element refers to vertex outside of its mesh");
+			}
+		} else {
+			//(triangle soup draws each vertex once, in order)
+			mesh_indices.resize(mesh_vertices.size());
+			for (uint32_t v = 0; v < uint32_t(mesh_indices.size()); ++v) mesh_indices[v] = v;
+		}
+		if (mesh_indices.size() % 3 != 0) {
+			throw std::runtime_error("mesh '" + name + "' doesn't contain a whole number of triangles");
+		}
+
+		out.before = analyze_vertex_cache(mesh_indices, uint32_t(mesh_vertices.size()), options.cache_size);
+		out.vertices_before = uint32_t(mesh_vertices.size());
+
+		//weld (also merges duplicates an indexed mesh might still have):
+		{
+			std::vector< uint32_t > welded = weld_vertices(&mesh_vertices);
+			for (uint32_t &e : mesh_indices) e = welded[e];
+		}
+
+		std::vector< glm::vec3 > positions, normals;
+		positions.reserve(mesh_vertices.size());
+		normals.reserve(mesh_vertices.size());
+		for (Vertex const &v : mesh_vertices) {
+			positions.emplace_back(v.Position);
+			normals.emplace_back(v.Normal);
+		}
+
+		//levels of detail (stopping early if simplification stops paying off):
+		auto &levels = out.levels;
+		std::vector< float > errors;
+		levels.emplace_back(mesh_indices);
+		errors.emplace_back(0.0f);
+		uint32_t triangles = uint32_t(mesh_indices.size() / 3);
+		for (uint32_t l = 1; l <= options.lods && l < 32; ++l) {
+			float error = 0.0f;
+			std::vector< uint32_t > simplified = simplify_mesh(levels.back(), positions, normals, triangles >> l, &error);
+			if (simplified.empty() || simplified.size() > levels.back().size() * 8 / 10) break;
+			levels.emplace_back(std::move(simplified));
+			errors.emplace_back(error);
+		}
+
+		for (auto &level : levels) {
+			std::vector< uint32_t > boundaries = optimize_vertex_cache(&level, uint32_t(mesh_vertices.size()), options.cache_size);
+			optimize_overdraw(&level, positions, boundaries, 1.05f, options.cache_size);
+		}
+
+		//renumber vertices by first use in the full-detail mesh (simplified levels only use a subset of its vertices):
+		std::vector< uint32_t > all_levels;
+		for (auto const &level : levels) all_levels.insert(all_levels.end(), level.begin(), level.end());
+		std::vector< uint32_t > old_numbers = optimize_vertex_fetch(&all_levels, uint32_t(mesh_vertices.size()));
+		{
+			auto at = all_levels.begin();
+			for (auto &level : levels) {
+				std::copy(at, at + level.size(), level.begin());
+				at += level.size();
+			}
+		}
+
+		out.vertices.reserve(old_numbers.size());
+		out.bounds.min = glm::vec3( std::numeric_limits< float >::infinity());
+		out.bounds.max = glm::vec3(-std::numeric_limits< float >::infinity());
+		for (uint32_t v : old_numbers) {
+			out.vertices.emplace_back(mesh_vertices[v]);
+			out.bounds.min = glm::min(out.bounds.min, mesh_vertices[v].Position);
+			out.bounds.max = glm::max(out.bounds.max, mesh_vertices[v].Position);
+		}
+
+		out.after = analyze_vertex_cache(levels[0], uint32_t(old_numbers.size()), options.cache_size);
+
+		std::ostringstream log;
+		log << name << ": " << levels[0].size() / 3 << " triangles, "
+		    << out.vertices_before << " -> " << old_numbers.size() << " vertices\n";
+		print_stats(log, "before:", out.before);
+		print_stats(log, "after: ", out.after);
+		for (uint32_t l = 1; l < levels.size(); ++l) {
+			log << "  LOD " << l << ": " << levels[l].size() / 3 << " triangles (error " << std::setprecision(4) << errors[l] << ")\n";
+		}
+		out.log = log.str();
+	});
+
+	//------ gather (in file order) ------
+	std::vector< Vertex > out_vertices;
+	std::vector< IndexEntry > out_index;
+	std::vector< ElementRange > out_ranges;
+	std::vector< uint32_t > out_elements;
+	std::vector< LODEntry > out_lods;
+	std::vector< BoundsEntry > out_bounds;
+
+	VertexCacheStats total_before, total_after;
+	uint32_t total_triangles = 0, total_vertices_before = 0, total_vertices_after = 0;
+
+	for (uint32_t i = 0; i < uint32_t(index.size()); ++i) {
+		Compiled const &mesh = compiled[i];
+		std::cout << mesh.log;
+
+		//each mesh gets its own vertex range:
+		IndexEntry out_entry = index[i];
+		out_entry.vertex_begin = uint32_t(out_vertices.size());
+		out_vertices.insert(out_vertices.end(), mesh.vertices.begin(), mesh.vertices.end());
+		out_entry.vertex_end = uint32_t(out_vertices.size());
+		out_index.emplace_back(out_entry);
+
+		ElementRange out_range;
+		out_range.element_begin = uint32_t(out_elements.size());
+		out_elements.insert(out_elements.end(), mesh.levels[0].begin(), mesh.levels[0].end());
+		out_range.element_end = uint32_t(out_elements.size());
+		out_ranges.emplace_back(out_range);
+
+		for (uint32_t l = 1; l < mesh.levels.size(); ++l) {
+			LODEntry out_lod;
+			out_lod.index_entry = i;
+			out_lod.element_begin = uint32_t(out_elements.size());
+			out_elements.insert(out_elements.end(), mesh.levels[l].begin(), mesh.levels[l].end());
+			out_lod.element_end = uint32_t(out_elements.size());
+			out_lods.emplace_back(out_lod);
+		}
+
+		out_bounds.emplace_back(mesh.bounds);
+
+		total_before.transformed += mesh.before.transformed;
+		total_after.transformed += mesh.after.transformed;
+		total_triangles += uint32_t(mesh.levels[0].size() / 3);
+		total_vertices_before += mesh.vertices_before;
+		total_vertices_after += uint32_t(mesh.vertices.size());
+	}
+
+	if (total_triangles) {
+		total_before.acmr = float(total_before.transformed) / float(total_triangles);
+		total_after.acmr = float(total_after.transformed) / float(total_triangles);
+	}
+	//(vertices are counted per mesh, so ATVR here is relative to each mesh's own vertex count)
+	if (total_vertices_before) total_before.atvr = float(total_before.transformed) / float(total_vertices_before);
+	if (total_vertices_after) total_after.atvr = float(total_after.transformed) / float(total_vertices_after);
+	std::cout << "total: " << index.size() << " meshes, " << total_triangles << " triangles, "
+	          << total_vertices_before << " -> " << total_vertices_after << " vertices\n";
+	print_stats(std::cout, "before:", total_before);
+	print_stats(std::cout, "after: ", total_after);
+
+	//------ write ------
+	{
+		std::ofstream file(out_file, std::ios::binary);
+		if (!file) throw std::runtime_error("Failed to open '" + out_file + "' for writing.");
+		write_chunk("pnct", out_vertices, &file);
+		write_chunk("str0", padded(strings), &file);
+		write_chunk("idx0", out_index, &file);
+		write_chunk("elr0", out_ranges, &file);
+		write_chunk("ele0", out_elements, &file);
+		//(lod0 is written even if empty, since bnd0 follows it)
+		write_chunk("lod0", out_lods, &file);
+		write_chunk("bnd0", out_bounds, &file);
+		if (!file) throw std::runtime_error("Failed to write '" + out_file + "'.");
+	}
+	std::cout << "Wrote '" << out_file << "'." << std::endl;
+}
+
+//------ walkmeshes ------
+
+static void compile_walkmeshes(std::string const &in_file, std::string const &out_file, Options const &options) {
+	//------ read ------
+	std::vector< glm::vec3 > positions, normals;
+	std::vector< glm::uvec3 > triangles;
+	std::vector< char > strings;
+	std::vector< WalkIndexEntry > index;
+	{
+		std::ifstream file(in_file, std::ios::binary);
+		if (!file) throw std::runtime_error("Failed to open '" + in_file + "'.");
+		read_chunk(file, "p...", &positions);
+		read_chunk(file, "n...", &normals);
+		read_chunk(file, "tri0", &triangles);
+		read_chunk(file, "str0", &strings);
+		read_chunk(file, "idxA", &index);
+		//(adjacency from the exporter or an earlier run is built again from scratch)
+		if (file.peek() != EOF) {
+			std::vector< glm::uvec3 > old_adjacent;
+			read_chunk(file, "adj0", &old_adjacent);
+		}
+	}
+	if (positions.size() != normals.size()) {
+		throw std::runtime_error("Mis-matched position and normal sizes in '" + in_file + "'");
+	}
+
+	//adjacency is stored relative to each mesh's triangle range, so meshes may not share triangles:
+	{
+		std::vector< bool > claimed(triangles.size(), false);
+		for (auto const &e : index) {
+			if (!(e.triangle_begin <= e.triangle_end && e.triangle_end <= triangles.size())) {
+				throw std::runtime_error("Invalid triangle indices in index of '" + in_file + "'");
+			}
+			for (uint32_t ti = e.triangle_begin; ti < e.triangle_end; ++ti) {
+				if (claimed[ti]) throw std::runtime_error("Overlapping triangle ranges in index of '" + in_file + "'");
+				claimed[ti] = true;
+			}
+		}
+	}
+
+	//------ build adjacency for each mesh (in parallel) ------
+	//(triangles not in any mesh have no neighbors)
+	std::vector< glm::uvec3 > adjacent(triangles.size(), glm::uvec3(-1U));
+	std::vector< std::string > logs(index.size());
+
+	parallel_for(uint32_t(index.size()), options.threads, [&](uint32_t i) {
+		WalkIndexEntry const &e = index[i];
+		if (!(e.name_begin <= e.name_end && e.name_end <= strings.size())) {
+			throw std::runtime_error("Invalid name indices in index of '" + in_file + "'");
+		}
+		if (!(e.vertex_begin <= e.vertex_end && e.vertex_end <= positions.size())) {
+			throw std::runtime_error("Invalid vertex indices in index of '" + in_file + "'");
+		}
+		std::string name(strings.data() + e.name_begin, strings.data() + e.name_end);
+
+		uint32_t count = e.triangle_end - e.triangle_begin;
+		if (count >= (1U << 30)) {
+			throw std::runtime_error("Walkmesh '" + name + "' has too many triangles for adjacency");
+		}
+		for (uint32_t ti = e.triangle_begin; ti < e.triangle_end; ++ti) {
+			glm::uvec3 const &tri = triangles[ti];
+			for (uint32_t slot = 0; slot < 3; ++slot) {
+				if (!(e.vertex_begin <= tri[slot] && tri[slot] < e.vertex_end)) {
+					throw std::runtime_error("Invalid triangle in walkmesh '" + name + "' of '" + in_file + "'");
+				}
+			}
+		}
+
+		//directed edge [a,b] -> (triangle << 2 | slot) of the triangle using it (or -1U if more than one does):
+		auto edge_key = [](uint32_t a, uint32_t b) {
+			return (uint64_t(a) << 32) | uint64_t(b);
+		};
+		std::unordered_map< uint64_t, uint32_t > edges;
+		edges.reserve(size_t(count) * 3);
+		uint32_t shared = 0;
+		for (uint32_t ti = 0; ti < count; ++ti) {
+			glm::uvec3 const &tri = triangles[e.triangle_begin + ti];
+			for (uint32_t slot = 0; slot < 3; ++slot) {
+				auto ret = edges.emplace(edge_key(tri[slot], tri[(slot + 1) % 3]), (ti << 2) | slot);
+				if (!ret.second && ret.first->second != -1U) {
+					ret.first->second = -1U;
+					++shared;
+				}
+			}
+		}
+
+		//triangles are neighbors across [a,b] if the only triangle using [b,a] is the only one using [a,b]:
+		// (so adjacency is always symmetric, as WalkMesh expects)
+		for (uint32_t ti = 0; ti < count; ++ti) {
+			glm::uvec3 const &tri = triangles[e.triangle_begin + ti];
+			for (uint32_t slot = 0; slot < 3; ++slot) {
+				uint32_t a = tri[slot];
+				uint32_t b = tri[(slot + 1) % 3];
+				if (a == b || edges[edge_key(a, b)] == -1U) continue;
+				auto f = edges.find(edge_key(b, a));
+				if (f == edges.end()) continue;
+				adjacent[e.triangle_begin + ti][slot] = f->second;
+			}
+		}
+
+		std::ostringstream log;
+		log << name << ": " << (e.vertex_end - e.vertex_begin) << " vertices, " << count << " triangles\n";
+		if (shared) {
+			log << "  WARNING: " << shared << " edges are used by more than one triangle with the same orientation (left without neighbors).\n";
+		}
+		logs[i] = log.str();
+	});
+
+	for (auto const &log : logs) {
+		std::cout << log;
+	}
+
+	//------ write ------
+	{
+		std::ofstream file(out_file, std::ios::binary);
+		if (!file) throw std::runtime_error("Failed to open '" + out_file + "' for writing.");
+		write_chunk("p...", positions, &file);
+		write_chunk("n...", normals, &file);
+		write_chunk("tri0", triangles, &file);
+		write_chunk("str0", padded(strings), &file);
+		write_chunk("idxA", index, &file);
+		write_chunk("adj0", adjacent, &file);
+		if (!file) throw std::runtime_error("Failed to write '" + out_file + "'.");
+	}
+	std::cout << "Wrote '" << out_file << "'." << std::endl;
+}
+
+//------ main ------
+
+static bool ends_with(std::string const &str, std::string const &suffix) {
+	return str.size() >= suffix.size() && str.substr(str.size() - suffix.size()) == suffix;
+}
+
+int main(int argc, char **argv) {
+	std::string in_file, out_file;
+	Options options;
+
+	std::string usage = std::string("Usage:\n\t") + argv[0] + " <in.pnct|in.w> [out] [--threads=N] [--cache-size=N] [--lods=N]";
+	for (int argi = 1; argi < argc; ++argi) {
+		std::string arg = argv[argi];
+		if (arg.substr(0, 10) == "--threads=") {
+			options.threads = uint32_t(std::stoul(arg.substr(10)));
+		} else if (arg.substr(0, 13) == "--cache-size=") {
+			options.cache_size = uint32_t(std::stoul(arg.substr(13)));
+			if (options.cache_size < 3) {
+				std::cerr << "Cache size must be at least 3." << std::endl;
+				return 1;
+			}
+		} else if (arg.substr(0, 7) == "--lods=") {
+			options.lods = uint32_t(std::stoul(arg.substr(7)));
+		} else if (in_file.empty()) {
+			in_file = arg;
+		} else if (out_file.empty()) {
+			out_file = arg;
+		} else {
+			std::cerr << usage << std::endl;
+			return 1;
+		}
+	}
+	if (in_file.empty()) {
+		std::cerr << usage << std::endl;
+		return 1;
+	}
+	if (out_file.empty()) out_file = in_file;
+
+	if (ends_with(in_file, ".pnct")) {
+		compile_meshes(in_file, out_file, options);
+	} else if (ends_with(in_file, ".w")) {
+		compile_walkmeshes(in_file, out_file, options);
+	} else {
+		std::cerr << "Don't know how to compile '" << in_file << "' (expecting a .pnct or .w file)." << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
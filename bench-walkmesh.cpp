@@ -0,0 +1,290 @@
+//Micro-benchmarks for WalkMesh, run on synthetic meshes.
+//Usage:
+// bench-walkmesh [--min-triangles=N] [--max-triangles=N] [--kinds=flat,bowl,terrain] [--min-time=seconds] [--out=results.json]
+//Meshes are generated at 1k, 10k, 100k, ... triangles (between min and max);
+// results (ns/op, ops/s, and peak RSS) are written as JSON to stdout or the --out file.
+
+#include "WalkMesh.hpp"
+
+#include <glm/gtx/norm.hpp>
+
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+//peak resident set size of this process, in bytes:
+static uint64_t peak_rss() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+	return uint64_t(counters.PeakWorkingSetSize);
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+	#ifdef __APPLE__
+	return uint64_t(usage.ru_maxrss); //(bytes on macOS)
+	#else
+	return uint64_t(usage.ru_maxrss) * 1024; //(kilobytes on Linux)
+	#endif
+#endif
+}
+
+//generate an n x n grid (2 n^2 triangles) over [-size,size]^2, displaced in z according to 'kind':
+// "flat" -- a plane
+// "bowl" -- a paraboloid, like the phone-bank arena
+// "terrain" -- a few octaves of rolling hills plus per-vertex jitter
+static void make_mesh(std::string const &kind, uint32_t n, uint32_t seed, std::vector< glm::vec3 > *vertices_, std::vector< glm::vec3 > *normals_, std::vector< glm::uvec3 > *triangles_) {
+	assert(vertices_);
+	auto &vertices = *vertices_;
+	assert(normals_);
+	auto &normals = *normals_;
+	assert(triangles_);
+	auto &triangles = *triangles_;
+
+	std::mt19937 mt(seed);
+	std::uniform_real_distribution< float > jitter(-1.0f, 1.0f);
+
+	float const size = 100.0f;
+	float const cell = 2.0f * size / float(n);
+
+	vertices.clear();
+	vertices.reserve(size_t(n + 1) * size_t(n + 1));
+	for (uint32_t y = 0; y <= n; ++y) {
+		for (uint32_t x = 0; x <= n; ++x) {
+			float fx = float(x) * cell - size;
+			float fy = float(y) * cell - size;
+			float z = 0.0f;
+			if (kind == "bowl") {
+				z = 0.002f * (fx * fx + fy * fy);
+			} else if (kind == "terrain") {
+				z = 4.0f * std::sin(fx * 0.05f) * std::cos(fy * 0.07f)
+				  + 1.0f * std::sin(fx * 0.21f + 1.0f) * std::sin(fy * 0.17f)
+				  + 0.1f * cell * jitter(mt);
+			} else if (kind != "flat") {
+				throw std::runtime_error("Unknown mesh kind '" + kind + "'.");
+			}
+			vertices.emplace_back(fx, fy, z);
+		}
+	}
+
+	triangles.clear();
+	triangles.reserve(size_t(n) * size_t(n) * 2);
+	for (uint32_t y = 0; y < n; ++y) {
+		for (uint32_t x = 0; x < n; ++x) {
+			uint32_t a = y * (n + 1) + x;
+			uint32_t b = a + 1;
+			uint32_t c = a + (n + 1);
+			uint32_t d = c + 1;
+			triangles.emplace_back(a, b, d);
+			triangles.emplace_back(a, d, c);
+		}
+	}
+
+	//vertex normals as the average of adjacent face normals:
+	normals.assign(vertices.size(), glm::vec3(0.0f));
+	for (auto const &tri : triangles) {
+		glm::vec3 out = glm::normalize(glm::cross(vertices[tri.y] - vertices[tri.x], vertices[tri.z] - vertices[tri.x]));
+		normals[tri.x] += out;
+		normals[tri.y] += out;
+		normals[tri.z] += out;
+	}
+	for (auto &normal : normals) {
+		normal = glm::normalize(normal);
+	}
+}
+
+struct Result {
+	std::string kind;
+	uint64_t triangles;
+	std::string op;
+	uint64_t ops;
+	double seconds;
+	uint64_t peak_rss;
+};
+
+int main(int argc, char **argv) {
+	uint64_t min_triangles = 1000;
+	uint64_t max_triangles = 10000000;
+	std::vector< std::string > kinds = {"flat", "bowl", "terrain"};
+	double min_time = 0.25;
+	std::string out_file = "";
+
+	for (int argi = 1; argi < argc; ++argi) {
+		std::string arg = argv[argi];
+		auto value = [&arg](std::string const &prefix, std::string *value_) {
+			if (arg.compare(0, prefix.size(), prefix) != 0) return false;
+			*value_ = arg.substr(prefix.size());
+			return true;
+		};
+		std::string val;
+		if (value("--min-triangles=", &val)) {
+			min_triangles = std::stoull(val);
+		} else if (value("--max-triangles=", &val)) {
+			max_triangles = std::stoull(val);
+		} else if (value("--min-time=", &val)) {
+			min_time = std::stod(val);
+		} else if (value("--out=", &val)) {
+			out_file = val;
+		} else if (value("--kinds=", &val)) {
+			kinds.clear();
+			std::istringstream str(val);
+			std::string kind;
+			while (std::getline(str, kind, ',')) kinds.emplace_back(kind);
+		} else {
+			std::cerr << "Usage:\n\t" << argv[0] << " [--min-triangles=N] [--max-triangles=N] [--kinds=flat,bowl,terrain] [--min-time=seconds] [--out=results.json]" << std::endl;
+			return 1;
+		}
+	}
+
+	std::vector< Result > results;
+
+	//run 'op(i)' for i = 0, 1, ... (wrapping at 'inputs') until at least min_time has passed, and record the rate:
+	// (op returns a value that is folded into 'checksum' so the compiler can't skip the work)
+	float checksum = 0.0f;
+	auto measure = [&](std::string const &kind, uint64_t triangles, std::string const &name, size_t inputs, std::function< float(size_t) > const &op) {
+		auto before = std::chrono::steady_clock::now();
+		uint64_t ops = 0;
+		double elapsed = 0.0;
+		do {
+			for (size_t i = 0; i < inputs; ++i) {
+				checksum += op(i);
+			}
+			ops += inputs;
+			elapsed = std::chrono::duration< double >(std::chrono::steady_clock::now() - before).count();
+		} while (elapsed < min_time);
+		results.emplace_back(Result{kind, triangles, name, ops, elapsed, peak_rss()});
+		std::cerr << "  " << name << ": " << (elapsed / double(ops) * 1e9) << " ns/op" << std::endl;
+	};
+
+	for (std::string const &kind : kinds) {
+		for (uint64_t target = 1000; target <= max_triangles; target *= 10) {
+			if (target < min_triangles) continue;
+			uint32_t n = uint32_t(std::ceil(std::sqrt(double(target) / 2.0)));
+			uint64_t triangles = uint64_t(n) * uint64_t(n) * 2;
+			std::cerr << kind << " mesh, " << triangles << " triangles:" << std::endl;
+
+			//construction (generation isn't timed, just the WalkMesh constructor's work):
+			std::unique_ptr< WalkMesh > mesh;
+			{
+				std::vector< glm::vec3 > vertices, normals;
+				std::vector< glm::uvec3 > tris;
+				make_mesh(kind, n, 1, &vertices, &normals, &tris);
+				auto before = std::chrono::steady_clock::now();
+				mesh.reset(new WalkMesh(std::move(vertices), std::move(normals), std::move(tris)));
+				double elapsed = std::chrono::duration< double >(std::chrono::steady_clock::now() - before).count();
+				results.emplace_back(Result{kind, triangles, "construct", 1, elapsed, peak_rss()});
+				std::cerr << "  construct: " << (elapsed * 1e3) << " ms" << std::endl;
+			}
+			WalkMesh const &wm = *mesh;
+
+			//random query points / starting points / steps (fixed seed so runs are comparable):
+			std::mt19937 mt(0x1234);
+			std::uniform_real_distribution< float > coord(-100.0f, 100.0f);
+			std::uniform_real_distribution< float > unit(-1.0f, 1.0f);
+			float const cell = 200.0f / float(n);
+
+			constexpr size_t Inputs = 4096;
+			std::vector< glm::vec3 > points;
+			std::vector< WalkPoint > starts;
+			std::vector< glm::vec3 > steps;
+			std::vector< WalkPoint > edges; //points on (interior) triangle edges
+			for (size_t i = 0; i < Inputs; ++i) {
+				points.emplace_back(coord(mt), coord(mt), 10.0f * unit(mt));
+				steps.emplace_back(cell * unit(mt), cell * unit(mt), 0.0f);
+			}
+			for (size_t i = 0; i < Inputs; ++i) {
+				starts.emplace_back(wm.nearest_walk_point(points[i]));
+				//edge [a,b] of a random triangle (in the grid's interior so it has a neighbor):
+				uint32_t ti = uint32_t(mt() % wm.triangles.size());
+				uint32_t slot = uint32_t(mt() % 3);
+				if (wm.adjacent[ti][slot] == -1U) slot = (slot + 1) % 3;
+				if (wm.adjacent[ti][slot] == -1U) slot = (slot + 1) % 3;
+				glm::uvec3 const &tri = wm.triangles[ti];
+				float along = 0.5f + 0.4f * unit(mt);
+				edges.emplace_back(
+					glm::uvec3(tri[slot], tri[(slot + 1) % 3], tri[(slot + 2) % 3]),
+					glm::vec3(1.0f - along, along, 0.0f),
+					ti
+				);
+			}
+
+			measure(kind, triangles, "nearest_walk_point", Inputs, [&](size_t i) {
+				return wm.nearest_walk_point(points[i]).weights.x;
+			});
+
+			measure(kind, triangles, "walk_in_triangle", Inputs, [&](size_t i) {
+				WalkPoint end;
+				float time;
+				wm.walk_in_triangle(starts[i], steps[i], &end, &time);
+				return time;
+			});
+
+			measure(kind, triangles, "cross_edge", Inputs, [&](size_t i) {
+				WalkPoint end;
+				glm::quat rotation;
+				wm.cross_edge(edges[i], &end, &rotation);
+				return end.weights.x + rotation.w;
+			});
+
+			//full walks: agents take 16 steps of up to a few triangles each (walkers persist between rounds):
+			std::vector< WalkPoint > walkers = starts;
+			measure(kind, triangles, "walk_16_steps", Inputs, [&](size_t i) {
+				for (uint32_t s = 0; s < 16; ++s) {
+					wm.walk(&walkers[i], 2.0f * steps[(i + s) % Inputs]);
+				}
+				return walkers[i].weights.x;
+			});
+		}
+	}
+
+	//------ output ------
+	std::ostringstream json;
+	json.precision(9);
+	json << "{\n";
+	json << "\t\"benchmark\": \"walkmesh\",\n";
+	json << "\t\"results\": [\n";
+	for (size_t i = 0; i < results.size(); ++i) {
+		Result const &r = results[i];
+		json << "\t\t{ \"mesh\": \"" << r.kind << "\", \"triangles\": " << r.triangles
+		     << ", \"op\": \"" << r.op << "\", \"ops\": " << r.ops
+		     << ", \"ns_per_op\": " << (r.seconds / double(r.ops) * 1e9)
+		     << ", \"ops_per_s\": " << (double(r.ops) / r.seconds)
+		     << ", \"peak_rss_bytes\": " << r.peak_rss << " }"
+		     << (i + 1 < results.size() ? "," : "") << "\n";
+	}
+	json << "\t],\n";
+	json << "\t\"peak_rss_bytes\": " << peak_rss() << ",\n";
+	json << "\t\"checksum\": " << checksum << "\n";
+	json << "}\n";
+
+	if (out_file != "") {
+		std::ofstream out(out_file, std::ios::binary);
+		out << json.str();
+		if (!out) {
+			std::cerr << "Failed to write '" << out_file << "'." << std::endl;
+			return 1;
+		}
+	} else {
+		std::cout << json.str();
+	}
+
+	return 0;
+}
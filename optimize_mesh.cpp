@@ -0,0 +1,567 @@
+#include "optimize_mesh.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <queue>
+
+//FIFO post-transform cache, simulated with timestamps -- vertex v is cached if it was
+// transformed within the last 'size' transforms:
+struct FIFOCache {
+	FIFOCache(uint32_t vertex_count, uint32_t size_) : size(size_), stamps(vertex_count, 0) { }
+	uint32_t size;
+	uint32_t time = size + 1; //(so that a stamp of zero is never "in" the cache)
+	std::vector< uint32_t > stamps;
+
+	bool contains(uint32_t v) const { return time - stamps[v] <= size; }
+	//returns true on a miss:
+	bool fetch(uint32_t v) {
+		if (contains(v)) return false;
+		stamps[v] = time++;
+		return true;
+	}
+	void clear() { time += size + 1; }
+};
+
+VertexCacheStats analyze_vertex_cache(std::vector< uint32_t > const &indices, uint32_t vertex_count, uint32_t cache_size) {
+	assert(indices.size() % 3 == 0);
+	VertexCacheStats stats;
+	FIFOCache cache(vertex_count, cache_size);
+	std::vector< bool > used(vertex_count, false);
+	uint32_t used_count = 0;
+	for (uint32_t v : indices) {
+		assert(v < vertex_count);
+		if (cache.fetch(v)) stats.transformed += 1;
+		if (!used[v]) {
+			used[v] = true;
+			used_count += 1;
+		}
+	}
+	if (!indices.empty()) stats.acmr = float(stats.transformed) / float(indices.size() / 3);
+	if (used_count) stats.atvr = float(stats.transformed) / float(used_count);
+	return stats;
+}
+
+std::vector< uint32_t > optimize_vertex_cache(std::vector< uint32_t > *indices_, uint32_t vertex_count, uint32_t cache_size) {
+	assert(indices_);
+	auto &indices = *indices_;
+	assert(indices.size() % 3 == 0);
+	uint32_t triangle_count = uint32_t(indices.size() / 3);
+
+	std::vector< uint32_t > boundaries;
+	if (triangle_count == 0) return boundaries;
+
+	//triangles using each vertex (packed; vertex v's are [adjacency_begin[v], adjacency_begin[v+1])):
+	std::vector< uint32_t > adjacency_begin(vertex_count + 1, 0);
+	for (uint32_t v : indices) {
+		assert(v < vertex_count);
+		adjacency_begin[v + 1] += 1;
+	}
+	for (uint32_t v = 0; v < vertex_count; ++v) {
+		adjacency_begin[v + 1] += adjacency_begin[v];
+	}
+	std::vector< uint32_t > adjacency(indices.size());
+	{
+		std::vector< uint32_t > fill(adjacency_begin.begin(), adjacency_begin.end() - 1);
+		for (uint32_t i = 0; i < uint32_t(indices.size()); ++i) {
+			adjacency[fill[indices[i]]++] = i / 3;
+		}
+	}
+
+	//"live" triangles (not yet emitted) using each vertex:
+	std::vector< uint32_t > live(vertex_count);
+	for (uint32_t v = 0; v < vertex_count; ++v) {
+		live[v] = adjacency_begin[v + 1] - adjacency_begin[v];
+	}
+
+	FIFOCache cache(vertex_count, cache_size);
+	std::vector< bool > emitted(triangle_count, false);
+	std::vector< uint32_t > dead_end; //recently used vertices, in case fanning runs out of neighbors
+	std::vector< uint32_t > order;
+	order.reserve(triangle_count);
+	std::vector< uint32_t > candidates;
+
+	uint32_t cursor = 0; //vertices before this have no live triangles
+	uint32_t fanning = indices[0];
+	boundaries.emplace_back(0);
+
+	while (true) {
+		//emit all live triangles around 'fanning':
+		candidates.clear();
+		for (uint32_t a = adjacency_begin[fanning]; a < adjacency_begin[fanning + 1]; ++a) {
+			uint32_t t = adjacency[a];
+			if (emitted[t]) continue;
+			emitted[t] = true;
+			order.emplace_back(t);
+			for (uint32_t c = 0; c < 3; ++c) {
+				uint32_t v = indices[3 * t + c];
+				dead_end.emplace_back(v);
+				candidates.emplace_back(v);
+				live[v] -= 1;
+				cache.fetch(v);
+			}
+		}
+
+		//next fanning vertex: the candidate that will still be in the cache after its live triangles are emitted, and
+		// that entered the cache earliest (so it is used before it falls out):
+		uint32_t best = -1U;
+		int32_t best_priority = -1;
+		for (uint32_t v : candidates) {
+			if (live[v] == 0) continue;
+			int32_t priority = 0;
+			//(age + 2 * live is how far v would be from the cache's end after fanning it)
+			uint32_t age = cache.time - cache.stamps[v];
+			if (age + 2 * live[v] <= cache_size) priority = int32_t(age);
+			if (priority > best_priority) {
+				best_priority = priority;
+				best = v;
+			}
+		}
+
+		if (best == -1U) {
+			//dead end: try recently used vertices, then any vertex with live triangles:
+			while (!dead_end.empty()) {
+				uint32_t v = dead_end.back();
+				dead_end.pop_back();
+				if (live[v] > 0) {
+					best = v;
+					break;
+				}
+			}
+			if (best == -1U) {
+				while (cursor < vertex_count && live[cursor] == 0) ++cursor;
+				if (cursor == vertex_count) break; //all triangles emitted
+				best = cursor;
+				boundaries.emplace_back(uint32_t(order.size()));
+			}
+		}
+		fanning = best;
+	}
+	assert(order.size() == triangle_count);
+
+	std::vector< uint32_t > reordered;
+	reordered.reserve(indices.size());
+	for (uint32_t t : order) {
+		reordered.insert(reordered.end(), indices.begin() + 3 * t, indices.begin() + 3 * t + 3);
+	}
+	indices = std::move(reordered);
+
+	return boundaries;
+}
+
+void optimize_overdraw(std::vector< uint32_t > *indices_, std::vector< glm::vec3 > const &positions, std::vector< uint32_t > const &boundaries, float threshold, uint32_t cache_size) {
+	assert(indices_);
+	auto &indices = *indices_;
+	assert(indices.size() % 3 == 0);
+	uint32_t triangle_count = uint32_t(indices.size() / 3);
+	if (triangle_count == 0) return;
+
+	float acmr = analyze_vertex_cache(indices, uint32_t(positions.size()), cache_size).acmr;
+
+	//split the runs between boundaries into clusters: a cluster ends once its own miss ratio (starting from an empty
+	// cache) is within 'threshold' of the whole mesh's, so reordering clusters doesn't cost much cache reuse:
+	std::vector< uint32_t > clusters; //first triangle of each cluster
+	{
+		FIFOCache cache(uint32_t(positions.size()), cache_size);
+		std::vector< uint32_t > ends;
+		for (uint32_t b : boundaries) {
+			assert(b < triangle_count);
+			if (b > 0) ends.emplace_back(b);
+		}
+		ends.emplace_back(triangle_count);
+		uint32_t run = 0;
+		uint32_t start = 0;
+		uint32_t misses = 0;
+		for (uint32_t t = 0; t < triangle_count; ++t) {
+			if (t == start) {
+				clusters.emplace_back(start);
+				cache.clear();
+				misses = 0;
+			}
+			for (uint32_t c = 0; c < 3; ++c) {
+				if (cache.fetch(indices[3 * t + c])) misses += 1;
+			}
+			if (t + 1 == ends[run]) {
+				start = t + 1;
+				run += 1;
+			} else if (float(misses) <= threshold * acmr * float(t + 1 - start)) {
+				start = t + 1;
+			}
+		}
+	}
+	uint32_t cluster_count = uint32_t(clusters.size());
+	clusters.emplace_back(triangle_count);
+
+	//mesh center, averaged over triangle corners:
+	glm::vec3 mesh_center = glm::vec3(0.0f);
+	for (uint32_t v : indices) {
+		mesh_center += positions[v];
+	}
+	mesh_center /= float(indices.size());
+
+	//clusters whose (area-weighted) normal points away from the center draw first:
+	std::vector< float > outwardness(cluster_count);
+	for (uint32_t i = 0; i < cluster_count; ++i) {
+		glm::vec3 center = glm::vec3(0.0f);
+		glm::vec3 normal = glm::vec3(0.0f);
+		float area = 0.0f;
+		for (uint32_t t = clusters[i]; t < clusters[i+1]; ++t) {
+			glm::vec3 const &a = positions[indices[3 * t + 0]];
+			glm::vec3 const &b = positions[indices[3 * t + 1]];
+			glm::vec3 const &c = positions[indices[3 * t + 2]];
+			glm::vec3 n = glm::cross(b - a, c - a); //(length is twice the area)
+			float len = glm::length(n);
+			center += (a + b + c) * (len / 3.0f);
+			normal += n;
+			area += len;
+		}
+		if (area > 0.0f) center /= area;
+		float normal_len = glm::length(normal);
+		if (normal_len > 0.0f) normal /= normal_len;
+		outwardness[i] = glm::dot(center - mesh_center, normal);
+	}
+
+	std::vector< uint32_t > order(cluster_count);
+	for (uint32_t i = 0; i < cluster_count; ++i) order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [&outwardness](uint32_t a, uint32_t b) {
+		return outwardness[a] > outwardness[b];
+	});
+
+	std::vector< uint32_t > reordered;
+	reordered.reserve(indices.size());
+	for (uint32_t i : order) {
+		reordered.insert(reordered.end(), indices.begin() + 3 * clusters[i], indices.begin() + 3 * clusters[i+1]);
+	}
+	indices = std::move(reordered);
+}
+
+std::vector< uint32_t > optimize_vertex_fetch(std::vector< uint32_t > *indices_, uint32_t vertex_count) {
+	assert(indices_);
+	auto &indices = *indices_;
+	std::vector< uint32_t > renumber(vertex_count, -1U);
+	std::vector< uint32_t > old_numbers;
+	for (uint32_t &v : indices) {
+		assert(v < vertex_count);
+		if (renumber[v] == -1U) {
+			renumber[v] = uint32_t(old_numbers.size());
+			old_numbers.emplace_back(v);
+		}
+		v = renumber[v];
+	}
+	return old_numbers;
+}
+
+//symmetric 4x4 matrix summing the outer products of (weighted) plane equations, so evaluate(p) is the weighted sum of
+// squared distances from p to the planes:
+struct Quadric {
+	double xx = 0.0, xy = 0.0, xz = 0.0, xw = 0.0, yy = 0.0, yz = 0.0, yw = 0.0, zz = 0.0, zw = 0.0, ww = 0.0;
+	double weight = 0.0; //total weight of planes
+
+	void add_plane(glm::vec3 const &normal, float d, double w) {
+		double a = normal.x, b = normal.y, c = normal.z;
+		xx += w * a * a; xy += w * a * b; xz += w * a * c; xw += w * a * d;
+		yy += w * b * b; yz += w * b * c; yw += w * b * d;
+		zz += w * c * c; zw += w * c * d;
+		ww += w * double(d) * d;
+		weight += w;
+	}
+	void add(Quadric const &o) {
+		xx += o.xx; xy += o.xy; xz += o.xz; xw += o.xw;
+		yy += o.yy; yz += o.yz; yw += o.yw;
+		zz += o.zz; zw += o.zw;
+		ww += o.ww;
+		weight += o.weight;
+	}
+	double evaluate(glm::vec3 const &p) const {
+		double x = p.x, y = p.y, z = p.z;
+		double e = x * (xx * x + 2.0 * (xy * y + xz * z + xw))
+		         + y * (yy * y + 2.0 * (yz * z + yw))
+		         + z * (zz * z + 2.0 * zw)
+		         + ww;
+		return std::max(e, 0.0); //(rounding can make it slightly negative)
+	}
+};
+
+std::vector< uint32_t > simplify_mesh(std::vector< uint32_t > const &indices, std::vector< glm::vec3 > const &positions, std::vector< glm::vec3 > const &normals, uint32_t target_triangles, float *error_) {
+	assert(indices.size() % 3 == 0);
+	assert(normals.size() == positions.size());
+	uint32_t vertex_count = uint32_t(positions.size());
+	uint32_t triangle_count = uint32_t(indices.size() / 3);
+
+	//open boundaries are kept in place by planes through them (perpendicular to their triangle), weighted this much more
+	// heavily than the surface itself:
+	const double BoundaryWeight = 10.0;
+
+	//group vertices at the same position into "points" (which are what collapses actually move):
+	std::vector< uint32_t > point_of(vertex_count);
+	std::vector< glm::vec3 > point_position;
+	std::vector< uint32_t > point_vertices(vertex_count); //vertices of point p are [point_vertices_begin[p], point_vertices_begin[p+1])
+	std::vector< uint32_t > point_vertices_begin;
+	{
+		for (uint32_t v = 0; v < vertex_count; ++v) point_vertices[v] = v;
+		std::stable_sort(point_vertices.begin(), point_vertices.end(), [&positions](uint32_t a, uint32_t b) {
+			glm::vec3 const &pa = positions[a];
+			glm::vec3 const &pb = positions[b];
+			if (pa.x != pb.x) return pa.x < pb.x;
+			if (pa.y != pb.y) return pa.y < pb.y;
+			return pa.z < pb.z;
+		});
+		for (uint32_t i = 0; i < vertex_count; ++i) {
+			uint32_t v = point_vertices[i];
+			if (i == 0 || positions[v] != point_position.back()) {
+				point_vertices_begin.emplace_back(i);
+				point_position.emplace_back(positions[v]);
+			}
+			point_of[v] = uint32_t(point_position.size()) - 1;
+		}
+		point_vertices_begin.emplace_back(vertex_count);
+	}
+	uint32_t point_count = uint32_t(point_position.size());
+
+	//triangles (as vertices, which change as collapses happen) and the triangles around each point:
+	std::vector< uint32_t > corners(indices);
+	std::vector< bool > triangle_alive(triangle_count, true);
+	std::vector< std::vector< uint32_t > > point_triangles(point_count);
+	uint32_t alive_count = 0;
+	for (uint32_t t = 0; t < triangle_count; ++t) {
+		uint32_t a = point_of[corners[3*t+0]], b = point_of[corners[3*t+1]], c = point_of[corners[3*t+2]];
+		if (a == b || b == c || c == a) {
+			triangle_alive[t] = false; //(degenerate triangles are left out)
+			continue;
+		}
+		point_triangles[a].emplace_back(t);
+		point_triangles[b].emplace_back(t);
+		point_triangles[c].emplace_back(t);
+		alive_count += 1;
+	}
+
+	std::vector< uint32_t > result;
+	auto collect = [&]() {
+		result.clear();
+		for (uint32_t t = 0; t < triangle_count; ++t) {
+			if (triangle_alive[t]) result.insert(result.end(), corners.begin() + 3 * t, corners.begin() + 3 * t + 3);
+		}
+	};
+	if (error_) *error_ = 0.0f;
+	if (alive_count <= target_triangles) {
+		collect();
+		return result;
+	}
+
+	//how many triangles use each edge (between points):
+	auto edge_key = [](uint32_t a, uint32_t b) {
+		return (uint64_t(std::min(a, b)) << 32) | uint64_t(std::max(a, b));
+	};
+	std::unordered_map< uint64_t, uint32_t > edge_uses;
+	for (uint32_t t = 0; t < triangle_count; ++t) {
+		if (!triangle_alive[t]) continue;
+		for (uint32_t c = 0; c < 3; ++c) {
+			edge_uses[edge_key(point_of[corners[3*t+c]], point_of[corners[3*t+(c+1)%3]])] += 1;
+		}
+	}
+
+	//error quadrics for each point, and which points are on open boundaries (or non-manifold edges, which are locked):
+	std::vector< Quadric > quadrics(point_count);
+	std::vector< bool > boundary(point_count, false);
+	std::vector< bool > locked(point_count, false);
+	for (uint32_t t = 0; t < triangle_count; ++t) {
+		if (!triangle_alive[t]) continue;
+		uint32_t p[3] = { point_of[corners[3*t+0]], point_of[corners[3*t+1]], point_of[corners[3*t+2]] };
+		glm::vec3 normal = glm::cross(point_position[p[1]] - point_position[p[0]], point_position[p[2]] - point_position[p[0]]);
+		float len = glm::length(normal);
+		if (len == 0.0f) continue;
+		normal /= len;
+		for (uint32_t c = 0; c < 3; ++c) {
+			quadrics[p[c]].add_plane(normal, -glm::dot(normal, point_position[p[0]]), 0.5 * len); //(weighted by area)
+		}
+		for (uint32_t c = 0; c < 3; ++c) {
+			uint32_t a = p[c], b = p[(c+1)%3];
+			uint32_t uses = edge_uses[edge_key(a, b)];
+			if (uses == 1) {
+				glm::vec3 edge = point_position[b] - point_position[a];
+				glm::vec3 side = glm::cross(edge, normal);
+				float side_len = glm::length(side);
+				if (side_len > 0.0f) {
+					side /= side_len;
+					double weight = BoundaryWeight * double(glm::dot(edge, edge));
+					quadrics[a].add_plane(side, -glm::dot(side, point_position[a]), weight);
+					quadrics[b].add_plane(side, -glm::dot(side, point_position[a]), weight);
+				}
+				boundary[a] = boundary[b] = true;
+			} else if (uses > 2) {
+				locked[a] = locked[b] = true;
+			}
+		}
+	}
+
+	//living triangles around a point (dead ones are dropped from its list along the way):
+	auto alive_triangles = [&](uint32_t p) -> std::vector< uint32_t > const & {
+		auto &list = point_triangles[p];
+		list.erase(std::remove_if(list.begin(), list.end(), [&](uint32_t t) { return !triangle_alive[t]; }), list.end());
+		return list;
+	};
+	//points sharing a triangle with a point (sorted):
+	auto neighbors = [&](uint32_t p, std::vector< uint32_t > *out_) {
+		auto &out = *out_;
+		out.clear();
+		for (uint32_t t : alive_triangles(p)) {
+			for (uint32_t c = 0; c < 3; ++c) {
+				uint32_t q = point_of[corners[3*t+c]];
+				if (q != p) out.emplace_back(q);
+			}
+		}
+		std::sort(out.begin(), out.end());
+		out.erase(std::unique(out.begin(), out.end()), out.end());
+	};
+
+	//candidate collapses (moving point 'from' onto point 'to'), cheapest first:
+	struct Collapse {
+		double cost;
+		uint32_t from, to;
+		uint32_t from_version, to_version; //(collapses are stale if either point has changed since)
+		bool operator>(Collapse const &o) const {
+			if (cost != o.cost) return cost > o.cost;
+			if (from != o.from) return from > o.from;
+			return to > o.to;
+		}
+	};
+	std::priority_queue< Collapse, std::vector< Collapse >, std::greater< Collapse > > queue;
+	std::vector< uint32_t > versions(point_count, 0);
+	std::vector< bool > point_alive(point_count, true);
+
+	//queue the better direction (if any) of collapsing the edge between a and b:
+	// (boundary points can only move onto other boundary points, and locked points don't move)
+	auto consider = [&](uint32_t a, uint32_t b) {
+		bool a_to_b = !locked[a] && (!boundary[a] || boundary[b]);
+		bool b_to_a = !locked[b] && (!boundary[b] || boundary[a]);
+		Quadric sum = quadrics[a];
+		sum.add(quadrics[b]);
+		double cost_a_to_b = (a_to_b ? sum.evaluate(point_position[b]) : 0.0);
+		double cost_b_to_a = (b_to_a ? sum.evaluate(point_position[a]) : 0.0);
+		if (a_to_b && (!b_to_a || cost_a_to_b <= cost_b_to_a)) {
+			queue.push(Collapse{cost_a_to_b, a, b, versions[a], versions[b]});
+		} else if (b_to_a) {
+			queue.push(Collapse{cost_b_to_a, b, a, versions[b], versions[a]});
+		}
+	};
+	for (uint32_t t = 0; t < triangle_count; ++t) {
+		if (!triangle_alive[t]) continue;
+		for (uint32_t c = 0; c < 3; ++c) {
+			uint32_t a = point_of[corners[3*t+c]], b = point_of[corners[3*t+(c+1)%3]];
+			//(each interior edge appears twice, once in each direction)
+			if (a < b || edge_uses[edge_key(a, b)] == 1) consider(a, b);
+		}
+	}
+
+	double max_error = 0.0;
+	std::vector< uint32_t > from_neighbors, to_neighbors, shared, replacements;
+	while (alive_count > target_triangles && !queue.empty()) {
+		Collapse collapse = queue.top();
+		queue.pop();
+		uint32_t from = collapse.from, to = collapse.to;
+		if (!point_alive[from] || !point_alive[to]) continue;
+		if (collapse.from_version != versions[from] || collapse.to_version != versions[to]) {
+			consider(from, to); //(re-queue with current cost; if it isn't an edge any more, that's found below)
+			continue;
+		}
+
+		//triangles that will disappear (those with both points):
+		shared.clear();
+		for (uint32_t t : alive_triangles(from)) {
+			for (uint32_t c = 0; c < 3; ++c) {
+				if (point_of[corners[3*t+c]] == to) shared.emplace_back(t);
+			}
+		}
+		if (shared.empty() || shared.size() > 2) continue; //not an edge (any more), or not a manifold one
+		if (boundary[from] && shared.size() != 1) continue; //boundary points only slide along the boundary
+
+		//only points opposite the edge may neighbor both points, or the collapse would pinch the surface:
+		neighbors(from, &from_neighbors);
+		neighbors(to, &to_neighbors);
+		uint32_t common = 0;
+		for (uint32_t i = 0, j = 0; i < from_neighbors.size() && j < to_neighbors.size(); ) {
+			if (from_neighbors[i] < to_neighbors[j]) ++i;
+			else if (from_neighbors[i] > to_neighbors[j]) ++j;
+			else { ++common; ++i; ++j; }
+		}
+		if (common != shared.size()) continue;
+
+		//triangles that move must not flip over (or get too close to it):
+		bool flips = false;
+		for (uint32_t t : alive_triangles(from)) {
+			if (std::find(shared.begin(), shared.end(), t) != shared.end()) continue;
+			glm::vec3 before[3], after[3];
+			for (uint32_t c = 0; c < 3; ++c) {
+				uint32_t p = point_of[corners[3*t+c]];
+				before[c] = point_position[p];
+				after[c] = point_position[p == from ? to : p];
+			}
+			glm::vec3 n_before = glm::cross(before[1] - before[0], before[2] - before[0]);
+			glm::vec3 n_after = glm::cross(after[1] - after[0], after[2] - after[0]);
+			if (glm::dot(n_before, n_after) < 0.25f * glm::length(n_before) * glm::length(n_after) || n_after == glm::vec3(0.0f)) {
+				flips = true;
+				break;
+			}
+		}
+		if (flips) continue;
+
+		//vertex at 'to' that replaces vertex 'v' at 'from' -- one it shares a triangle with, or the one with the closest normal:
+		replacements.clear(); //(pairs of from, to vertices)
+		auto replacement = [&](uint32_t v) {
+			for (uint32_t i = 0; i < replacements.size(); i += 2) {
+				if (replacements[i] == v) return replacements[i+1];
+			}
+			uint32_t best = -1U;
+			for (uint32_t t : shared) {
+				for (uint32_t c = 0; c < 3 && best == -1U; ++c) {
+					if (corners[3*t+c] != v) continue;
+					for (uint32_t o = 0; o < 3; ++o) {
+						if (point_of[corners[3*t+o]] == to) best = corners[3*t+o];
+					}
+				}
+			}
+			if (best == -1U) {
+				float best_dot = -std::numeric_limits< float >::infinity();
+				for (uint32_t i = point_vertices_begin[to]; i < point_vertices_begin[to+1]; ++i) {
+					float dot = glm::dot(normals[v], normals[point_vertices[i]]);
+					if (dot > best_dot) {
+						best_dot = dot;
+						best = point_vertices[i];
+					}
+				}
+			}
+			replacements.emplace_back(v);
+			replacements.emplace_back(best);
+			return best;
+		};
+
+		//collapse:
+		for (uint32_t t : point_triangles[from]) {
+			if (std::find(shared.begin(), shared.end(), t) != shared.end()) continue;
+			for (uint32_t c = 0; c < 3; ++c) {
+				if (point_of[corners[3*t+c]] == from) corners[3*t+c] = replacement(corners[3*t+c]);
+			}
+			point_triangles[to].emplace_back(t);
+		}
+		for (uint32_t t : shared) {
+			triangle_alive[t] = false;
+			alive_count -= 1;
+		}
+		max_error = std::max(max_error, collapse.cost / std::max(quadrics[from].weight + quadrics[to].weight, 1e-30));
+		quadrics[to].add(quadrics[from]);
+		point_triangles[from].clear();
+		point_alive[from] = false;
+		versions[to] += 1;
+
+		neighbors(to, &to_neighbors);
+		for (uint32_t n : to_neighbors) {
+			consider(to, n);
+		}
+	}
+
+	if (error_) *error_ = float(std::sqrt(max_error));
+	collect();
+	return result;
+}
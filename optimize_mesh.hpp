@@ -0,0 +1,75 @@
+#pragma once
+
+/*
+ * Helpers for reordering indexed triangle lists so GPUs draw them faster:
+ *  - weld_vertices() turns triangle soup into an indexed mesh
+ *  - optimize_vertex_cache() orders triangles for post-transform cache reuse ("Tipsify",
+ *    Sander, Nehab, and Barczak 2007), returning the places where the order jumps
+ *  - optimize_overdraw() reorders clusters of those triangles so outward-facing parts come first
+ *  - optimize_vertex_fetch() renumbers vertices in order of first use
+ *  - simplify_mesh() makes a version with fewer triangles (for levels of detail) by collapsing edges in order of
+ *    quadric error (Garland and Heckbert 1997)
+ *
+ * These run offline (in asset-compiler) and don't need OpenGL.
+ *
+ */
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+#include <string>
+
+//post-transform cache size assumed when optimizing and analyzing (a common FIFO size):
+enum : uint32_t { VertexCacheSize = 16 };
+
+//vertex cache behavior of drawing a triangle list with a FIFO post-transform cache:
+struct VertexCacheStats {
+	uint32_t transformed = 0; //vertices run through the vertex shader (cache misses)
+	float acmr = 0.0f; //average cache miss ratio -- transformed per triangle (3 is worst; ~0.5 is ideal for large meshes)
+	float atvr = 0.0f; //average transform to vertex ratio -- transformed per vertex (1 is ideal)
+};
+VertexCacheStats analyze_vertex_cache(std::vector< uint32_t > const &indices, uint32_t vertex_count, uint32_t cache_size = VertexCacheSize);
+
+//replace 'vertices' with its unique elements (compared bytewise) and return indices that draw the same triangles:
+// (indices[i] is the new number of the old vertex i)
+template< typename Vertex >
+std::vector< uint32_t > weld_vertices(std::vector< Vertex > *vertices_) {
+	auto &vertices = *vertices_;
+	std::unordered_map< std::string, uint32_t > unique;
+	unique.reserve(vertices.size());
+	std::vector< uint32_t > indices;
+	indices.reserve(vertices.size());
+	std::vector< Vertex > welded;
+	for (Vertex const &vertex : vertices) {
+		std::string key(reinterpret_cast< char const * >(&vertex), sizeof(Vertex));
+		auto ret = unique.emplace(key, uint32_t(welded.size()));
+		if (ret.second) welded.emplace_back(vertex);
+		indices.emplace_back(ret.first->second);
+	}
+	vertices = std::move(welded);
+	return indices;
+}
+
+//reorder the triangles of 'indices' for vertex cache reuse:
+// returns the triangle numbers at which the new order starts over somewhere unconnected (always including 0, if there are triangles)
+std::vector< uint32_t > optimize_vertex_cache(std::vector< uint32_t > *indices, uint32_t vertex_count, uint32_t cache_size = VertexCacheSize);
+
+//reorder clusters of triangles (within the runs between 'boundaries', as returned by optimize_vertex_cache) so that those
+// facing away from the middle of the mesh come first -- these tend to cover the others, so drawing them first saves shading:
+// clusters are kept long enough that the cache miss ratio stays within 'threshold' times that of the current order
+void optimize_overdraw(std::vector< uint32_t > *indices, std::vector< glm::vec3 > const &positions, std::vector< uint32_t > const &boundaries, float threshold = 1.05f, uint32_t cache_size = VertexCacheSize);
+
+//renumber vertices in the order 'indices' first uses them (so they are fetched from memory in order):
+// returns the old number of each new vertex (unused vertices are left out)
+std::vector< uint32_t > optimize_vertex_fetch(std::vector< uint32_t > *indices, uint32_t vertex_count);
+
+//simplify a triangle list by collapsing edges (each moving a vertex onto a neighbor) until at most 'target_triangles'
+// remain, or no collapse is possible without folding triangles over or changing open boundaries:
+// - vertices at the same position are treated as one, so attribute seams (e.g., on flat-shaded meshes) don't stop
+//   simplification; a removed vertex is replaced by the vertex at the kept position that shares a triangle with it or
+//   (failing that) has the most similar normal
+// - returns indices of the simplified triangles, using the same vertex numbers (so only a subset of vertices is used)
+// - if 'error_' is given, sets it to the largest (approximate) distance that collapses moved the surface
+std::vector< uint32_t > simplify_mesh(std::vector< uint32_t > const &indices, std::vector< glm::vec3 > const &positions, std::vector< glm::vec3 > const &normals, uint32_t target_triangles, float *error_ = nullptr);
@@ -4,6 +4,8 @@
 #include <vector>
 #include <stdexcept>
 #include <cassert>
+#include <cstring>
+#include <string>
 
 //helper function that reads an array of structures preceded by a simple header:
 //Expected format:
@@ -35,11 +37,53 @@ void read_chunk(std::istream &from, std::string const &magic, std::vector< T > *
 	}
 
 	to.resize(header.size / sizeof(T));
-	if (!from.read(reinterpret_cast< char * >(&to[0]), to.size() * sizeof(T))) {
+	if (!from.read(reinterpret_cast< char * >(to.data()), to.size() * sizeof(T))) {
 		throw std::runtime_error("Failed to read chunk data.");
 	}
 }
 
+//helper function that finds the same array-of-structures chunk in memory (e.g., a memory-mapped file) without copying it:
+// - *at_ is advanced past the chunk (and must be <= end)
+// - *data_ gets a pointer to the first byte of chunk data, and the function returns the number of T's in the chunk
+//NOTE: chunk data is only byte-aligned (chunks may follow odd-sized chunks), so copy elements out with memcpy.
+// (asset-compiler pads string chunks so that the chunks it writes are 4-byte aligned, but other writers don't)
+template< typename T >
+size_t view_chunk(char const **at_, char const *end, std::string const &magic, char const **data_) {
+	assert(at_ && *at_ <= end);
+	assert(data_);
+	auto &at = *at_;
+
+	char header_magic[4];
+	uint32_t size;
+	static_assert(sizeof(header_magic) + sizeof(size) == 8, "header is packed");
+
+	if (size_t(end - at) < 8) {
+		throw std::runtime_error("Failed to read chunk header");
+	}
+	std::memcpy(header_magic, at, 4);
+	std::memcpy(&size, at + 4, 4);
+	if (std::string(header_magic,4) != magic) {
+		throw std::runtime_error("Unexpected magic number in chunk");
+	}
+
+	if (size % sizeof(T) != 0) {
+		throw std::runtime_error("Size of chunk not divisible by element size");
+	}
+	if (size_t(end - at) - 8 < size) {
+		throw std::runtime_error("Failed to read chunk data.");
+	}
+
+	*data_ = at + 8;
+	at += 8 + size_t(size);
+	return size / sizeof(T);
+}
+
+//helper function that checks (without advancing) if the next chunk in memory has the given magic number:
+// (useful for optional chunks)
+inline bool next_chunk_is(char const *at, char const *end, std::string const &magic) {
+	assert(magic.size() == 4);
+	return size_t(end - at) >= 8 && std::memcmp(at, magic.data(), 4) == 0;
+}
 
 //helper function to write a chunk of data in the same format as read_chunk:
 template< typename T >
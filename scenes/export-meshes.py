@@ -3,6 +3,7 @@
 #based on 'export-sprites.py' and 'glsprite.py' from TCHOW Rainbow; code used is released into the public domain.
 #Patched for 15-466-f19 to remove non-pnct formats!
 #Patched for 15-466-f20 to merge data all at once (slightly faster)
+#Patched to gather vertex data in bulk with numpy and leave welding to asset-compiler
 
 #Note: Script meant to be executed within blender, as per:
 #blender --background --python export-meshes.py -- [...see below...]
@@ -38,6 +39,16 @@ else:
 print(" of '" + infile + "' to '" + outfile + "'.")
 
 import struct
+import numpy
+
+#same layout as the 'pnct' chunk (see Mesh.cpp):
+Vertex = numpy.dtype([
+	('Position', numpy.float32, 3),
+	('Normal', numpy.float32, 3),
+	('Color', numpy.uint8, 4),
+	('TexCoord', numpy.float32, 2),
+])
+assert(Vertex.itemsize == 4*3+4*3+1*4+4*2)
 
 bpy.ops.wm.open_mainfile(filepath=infile)
 
@@ -159,35 +170,43 @@ for obj in bpy.data.objects:
 		if len(obj.data.uv_layers) != 1:
 			print("WARNING: object '" + name + "' has multiple texture coordinate layers; only exporting '" + obj.data.uv_layers.active.name + "'")
 
-	local_data = b''
-
-	#write the mesh triangles:
-	for poly in mesh.polygons:
-		assert(len(poly.loop_indices) == 3)
-		for i in range(0,3):
-			assert(mesh.loops[poly.loop_indices[i]].vertex_index == poly.vertices[i])
-			loop = mesh.loops[poly.loop_indices[i]]
-			vertex = mesh.vertices[loop.vertex_index]
-			for x in vertex.co:
-				local_data += struct.pack('f', x)
-			for x in loop.normal:
-				local_data += struct.pack('f', x)
-			if colors != None:
-				col = colors[poly.loop_indices[i]].color
-				local_data += struct.pack('BBBB', int(col[0] * 255), int(col[1] * 255), int(col[2] * 255), 255)
-			else:
-				local_data += struct.pack('BBBB', 255, 255, 255, 255)
-			if uvs != None:
-				uv = uvs[poly.loop_indices[i]].uv
-				local_data += struct.pack('ff', uv.x, uv.y)
-			else:
-				local_data += struct.pack('ff', 0, 0)
-		if len(local_data) > 1000:
-			data.append(local_data)
-			local_data = b''
-	vertex_count += len(mesh.polygons) * 3
-
-	data.append(local_data)
+	#gather per-corner data in bulk (as triangle soup; asset-compiler welds it into indexed meshes):
+	loop_count = len(mesh.loops)
+	corners = numpy.zeros(loop_count, dtype=Vertex)
+
+	loop_vertices = numpy.zeros(loop_count, dtype=numpy.uint32)
+	mesh.loops.foreach_get('vertex_index', loop_vertices)
+	positions = numpy.zeros(len(mesh.vertices) * 3, dtype=numpy.float32)
+	mesh.vertices.foreach_get('co', positions)
+	corners['Position'] = positions.reshape(-1, 3)[loop_vertices]
+
+	normals = numpy.zeros(loop_count * 3, dtype=numpy.float32)
+	mesh.loops.foreach_get('normal', normals)
+	corners['Normal'] = normals.reshape(-1, 3)
+
+	if colors != None:
+		rgba = numpy.zeros(loop_count * 4, dtype=numpy.float32)
+		colors.foreach_get('color', rgba)
+		corners['Color'][:,0:3] = (rgba.reshape(-1, 4)[:,0:3] * 255).astype(numpy.uint8)
+		corners['Color'][:,3] = 255
+	else:
+		corners['Color'] = 255
+
+	if uvs != None:
+		uv = numpy.zeros(loop_count * 2, dtype=numpy.float32)
+		uvs.foreach_get('uv', uv)
+		corners['TexCoord'] = uv.reshape(-1, 2)
+
+	#write corners triangle by triangle:
+	loop_starts = numpy.zeros(len(mesh.polygons), dtype=numpy.uint32)
+	mesh.polygons.foreach_get('loop_start', loop_starts)
+	loop_totals = numpy.zeros(len(mesh.polygons), dtype=numpy.uint32)
+	mesh.polygons.foreach_get('loop_total', loop_totals)
+	assert(numpy.all(loop_totals == 3))
+	order = (loop_starts.reshape(-1, 1) + numpy.arange(3, dtype=numpy.uint32)).reshape(-1)
+
+	data.append(corners[order].tobytes())
+	vertex_count += len(order)
 
 	index += struct.pack('I', vertex_count) #vertex_end
 
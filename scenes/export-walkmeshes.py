@@ -5,15 +5,23 @@
 #Note: Script meant to be executed from within blender, as per:
 #blender --background --python export-meshes.py -- <infile.blend>[:collection] <outfile.w>
 
-import sys,re
+import sys,re,math
 
 args = []
 for i in range(0,len(sys.argv)):
 	if sys.argv[i] == '--':
 		args = sys.argv[i+1:]
 
+#optional --tile-size=<size> splits each mesh into square tiles for streaming:
+tile_size = None
+for arg in args:
+	if arg.startswith('--tile-size='):
+		tile_size = float(arg[len('--tile-size='):])
+		assert(tile_size > 0.0)
+args = [ arg for arg in args if not arg.startswith('--tile-size=') ]
+
 if len(args) < 2 or len(args) > 3:
-	print("\n\nUsage:\nblender --background --python export-walkmeshes.py -- <infile.blend>[:collection] [pattern] <outfile.w>\nExports the meshes with names matching regex /pattern/ (default /.*/) referenced by all objects in collection to a binary blob, in walkmesh format, indexed by the names of the objects that reference them.\n")
+	print("\n\nUsage:\nblender --background --python export-walkmeshes.py -- [--tile-size=<size>] <infile.blend>[:collection] [pattern] <outfile.w>\nExports the meshes with names matching regex /pattern/ (default /.*/) referenced by all objects in collection to a binary blob, in walkmesh format, indexed by the names of the objects that reference them.\nIf --tile-size is given, each mesh is split into <size> x <size> tiles (in the xy plane) named 'name[x,y]'.\n")
 	exit(1)
 
 infile = args[0]
@@ -139,73 +147,90 @@ for obj in bpy.data.objects:
 	#compute normals (respecting face smoothing):
 	mesh.calc_normals_split()
 
-	#store the beginning indices:
-	vertex_begin = position_count
-	triangle_begin = triangle_count
-
-
-	#Helper to write referenced vertices:
-	vertex_inds = dict() #for each referenced vertex, store new index
-	vertex_normals = [] #for each referenced vertex, store list of normals
-	def write_vertex(index, normal):
-		global positions, position_count, vertex_refs, vertex_normals
-		if index not in vertex_inds:
-			vertex_inds[index] = len(vertex_inds)
-			vertex_normals.append([])
-			positions += struct.pack('fff', *mesh.vertices[index].co)
-			position_count += 1
-		vertex_normals[vertex_inds[index]].append(normal)
-		return struct.pack('I', vertex_begin + vertex_inds[index])
-
-	#write the mesh triangles:
-	for poly in mesh.polygons:
-		assert(len(poly.loop_indices) == 3)
-
-		#check that faces are CCW-oriented:
-		ab =  mesh.vertices[poly.vertices[1]].co - mesh.vertices[poly.vertices[0]].co
-		ac =  mesh.vertices[poly.vertices[2]].co - mesh.vertices[poly.vertices[0]].co
-		out = ab.cross(ac).normalized()
-		d = poly.normal.dot(out)
-		assert(d > 0.9)
-
-		for i in range(0,3):
-			assert(mesh.loops[poly.loop_indices[i]].vertex_index == poly.vertices[i])
-			triangles += write_vertex(poly.vertices[i], mesh.loops[poly.loop_indices[i]].normal)
-		triangle_count += 1
-	
-	#write (and possibly average) the normals:
-	for ns in vertex_normals:
-		avg = None
-		for n in ns:
-			if avg == None: avg = n
-			else: avg = avg + n
-		avg = avg / len(ns)
-		for n in ns:
-			diff = (n - avg).length
-			if diff > 0.001:
-				print("Normal " + str(n) + " different than average " + str(avg) + " of " + str(len(ns)) + ".")
-		normals += struct.pack('fff', *avg)
-		normal_count += 1
-	
-	assert(normal_count == position_count)
-
-	vertex_end = position_count
-	triangle_end = triangle_count
-
-	assert(vertex_end - vertex_begin == len(vertex_inds))
-
-	#record mesh name, vertex range, and triangle range:
-	name_begin = len(strings)
-	strings += bytes(name, "utf8")
-	name_end = len(strings)
-	index += struct.pack('II', name_begin, name_end)
-	index += struct.pack('II', vertex_begin, vertex_end)
-	index += struct.pack('II', triangle_begin, triangle_end)
+	#split triangles into square tiles (in the xy plane, by centroid) if requested:
+	# (each tile is written as its own walkmesh, named 'name[x,y]'; see TiledWalkMesh)
+	if tile_size != None:
+		tiles = dict()
+		for poly in mesh.polygons:
+			key = (math.floor(poly.center.x / tile_size), math.floor(poly.center.y / tile_size))
+			if key not in tiles: tiles[key] = []
+			tiles[key].append(poly)
+		parts = []
+		for key in sorted(tiles.keys()):
+			parts.append((name + '[' + str(key[0]) + ',' + str(key[1]) + ']', tiles[key]))
+		print("  split into " + str(len(parts)) + " tiles.")
+	else:
+		parts = [(name, mesh.polygons)]
+
+	for (part_name, part_polys) in parts:
+		#store the beginning indices:
+		vertex_begin = position_count
+		triangle_begin = triangle_count
+
+
+		#Helper to write referenced vertices:
+		vertex_inds = dict() #for each referenced vertex, store new index
+		vertex_normals = [] #for each referenced vertex, store list of normals
+		def write_vertex(index, normal):
+			global positions, position_count, vertex_refs, vertex_normals
+			if index not in vertex_inds:
+				vertex_inds[index] = len(vertex_inds)
+				vertex_normals.append([])
+				positions += struct.pack('fff', *mesh.vertices[index].co)
+				position_count += 1
+			vertex_normals[vertex_inds[index]].append(normal)
+			return struct.pack('I', vertex_begin + vertex_inds[index])
+
+		#write the mesh triangles:
+		for poly in part_polys:
+			assert(len(poly.loop_indices) == 3)
+
+			#check that faces are CCW-oriented:
+			ab =  mesh.vertices[poly.vertices[1]].co - mesh.vertices[poly.vertices[0]].co
+			ac =  mesh.vertices[poly.vertices[2]].co - mesh.vertices[poly.vertices[0]].co
+			out = ab.cross(ac).normalized()
+			d = poly.normal.dot(out)
+			assert(d > 0.9)
+
+			for i in range(0,3):
+				assert(mesh.loops[poly.loop_indices[i]].vertex_index == poly.vertices[i])
+				triangles += write_vertex(poly.vertices[i], mesh.loops[poly.loop_indices[i]].normal)
+			triangle_count += 1
+
+		#write (and possibly average) the normals:
+		for ns in vertex_normals:
+			avg = None
+			for n in ns:
+				if avg == None: avg = n
+				else: avg = avg + n
+			avg = avg / len(ns)
+			for n in ns:
+				diff = (n - avg).length
+				if diff > 0.001:
+					print("Normal " + str(n) + " different than average " + str(avg) + " of " + str(len(ns)) + ".")
+			normals += struct.pack('fff', *avg)
+			normal_count += 1
+		
+		assert(normal_count == position_count)
+
+		vertex_end = position_count
+		triangle_end = triangle_count
+
+		assert(vertex_end - vertex_begin == len(vertex_inds))
+
+		#record mesh name, vertex range, and triangle range:
+		name_begin = len(strings)
+		strings += bytes(part_name, "utf8")
+		name_end = len(strings)
+		index += struct.pack('II', name_begin, name_end)
+		index += struct.pack('II', vertex_begin, vertex_end)
+		index += struct.pack('II', triangle_begin, triangle_end)
 
 
 #check that we wrote as much data as anticipated:
 assert(position_count * 3*4 == len(positions))
 assert(normal_count * 3*4 == len(normals))
+assert(triangle_count * 3*4 == len(triangles))
 
 #write the data chunk and index chunk to an output blob:
 blob = open(outfile, 'wb')
@@ -221,6 +246,7 @@ write_chunk(b'n...', normals)
 write_chunk(b'tri0', triangles)
 write_chunk(b'str0', strings)
 write_chunk(b'idxA', index)
+#(triangle adjacency -- the optional 'adj0' chunk -- is added by asset-compiler)
 wrote = blob.tell()
 blob.close()
 
@@ -109,17 +109,13 @@ int main(int argc, char **argv) {
 			scene = new Scene();
 			scene->load(scene_file, [&buffer,&buffer_vao](Scene &scene, Scene::Transform *transform, std::string const &mesh_name){
 				if (!buffer_vao) return;
-				Mesh const &mesh = buffer->lookup(mesh_name);
-
 				scene.drawables.emplace_back(transform);
 				Scene::Drawable &drawable = scene.drawables.back();
 
 				drawable.pipeline = show_scene_program_pipeline;
 
 				drawable.pipeline.vao = buffer_vao;
-				drawable.pipeline.type = mesh.type;
-				drawable.pipeline.start = mesh.start;
-				drawable.pipeline.count = mesh.count;
+				drawable.set_mesh(*buffer, mesh_name);
 
 			});
 		} catch (std::exception &e) {